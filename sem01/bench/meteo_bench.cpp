@@ -0,0 +1,463 @@
+// Benchmark of the phases of the pipeline, serial (also with the vectorized
+// statistics) and in parallel with a sweep of thread counts. Has to be run
+// from a directory with `czmap.svg`, the rendered maps are written to
+// `output/` like with `meteo`.
+
+#include "config.hpp"
+#include "mapped_file.hpp"
+#include "outliers.hpp"
+#include "parsing.hpp"
+#include "preprocessor.hpp"
+#include "renderer.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr std::array<std::string_view, 6> PHASES = {
+    "parse", "stats", "preprocess", "outliers", "render", "total"};
+
+enum class OutputFormat { Table, Csv, Json };
+
+struct BenchConfig {
+  size_t runs = 20;
+  size_t warmup = 3;
+  std::vector<size_t> threads;
+  OutputFormat format = OutputFormat::Table;
+  std::optional<std::filesystem::path> output_file;
+  topology::AffinityPolicy pin = topology::AffinityPolicy::None;
+  std::filesystem::path stations_file;
+  std::filesystem::path measurements_file;
+};
+
+/**
+ * @brief Thread counts 1, 2, 4, … up to and including the number of hardware
+ * threads.
+ */
+std::vector<size_t> default_thread_sweep() {
+  const size_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+
+  std::vector<size_t> threads;
+  for (size_t count = 1; count < hardware; count *= 2) {
+    threads.push_back(count);
+  }
+  threads.push_back(hardware);
+  return threads;
+}
+
+BenchConfig parse_arguments(const int argc, const char *const argv[]) {
+  const auto usage_message = [&argv]() {
+    return std::format(
+        "Usage: {} [--runs <count>] [--warmup <count>] "
+        "[--threads <count>,...] [--pin <policy>] [--format table|csv|json] "
+        "[--output <file>] <stations_file> <measurements_file>",
+        std::string(argv[0]));
+  };
+
+  const auto next_value = [&](int &i) {
+    if (++i == argc) {
+      throw std::invalid_argument(usage_message());
+    }
+    return std::string_view(argv[i]);
+  };
+
+  BenchConfig config;
+  std::vector<std::string> positional;
+
+  for (int i = 1; i < argc; i++) {
+    const auto arg = std::string(argv[i]);
+    if (arg == "--runs") {
+      config.runs = parse_positive(next_value(i), false);
+    } else if (arg == "--warmup") {
+      const auto value = next_value(i);
+      config.warmup = value == "0" ? 0 : parse_positive(value, false);
+    } else if (arg == "--threads") {
+      for (const auto part : std::views::split(next_value(i), ',')) {
+        config.threads.push_back(parse_positive(
+            std::string_view(part.begin(), part.end()), false));
+      }
+    } else if (arg == "--pin") {
+      config.pin = topology::parse_policy(next_value(i));
+    } else if (arg == "--format") {
+      const auto format = next_value(i);
+      if (format == "table") {
+        config.format = OutputFormat::Table;
+      } else if (format == "csv") {
+        config.format = OutputFormat::Csv;
+      } else if (format == "json") {
+        config.format = OutputFormat::Json;
+      } else {
+        throw std::invalid_argument(usage_message());
+      }
+    } else if (arg == "--output") {
+      config.output_file = std::filesystem::path(next_value(i));
+    } else if (arg.starts_with("--")) {
+      throw std::invalid_argument(usage_message());
+    } else {
+      positional.push_back(arg);
+    }
+  }
+
+  if (positional.size() != 2) {
+    throw std::invalid_argument(usage_message());
+  }
+
+  config.stations_file = positional[0];
+  config.measurements_file = positional[1];
+
+  if (config.threads.empty()) {
+    config.threads = default_thread_sweep();
+  }
+
+  return config;
+}
+
+/**
+ * @brief The configurations compared by the benchmark.
+ */
+enum class Variant {
+  Serial,
+  // serial, but with the vectorized statistics kernels
+  Simd,
+  Parallel,
+  // parallel, with the vectorized statistics kernels
+  ParallelSimd,
+};
+
+// duration of each phase of a single run in μs
+using Timings = std::array<double, PHASES.size()>;
+
+/**
+ * @brief Runs the whole pipeline once and measures each phase.
+ *
+ * Every run parses the input again, so the preprocessing always gets fresh
+ * data without copying it. The statistics come before the preprocessing,
+ * which only discards the stations they found invalid.
+ */
+Timings run_pipeline(const Variant variant,
+                     const std::string_view stations_content,
+                     const std::string_view measurements_content) {
+  const auto mode =
+      variant == Variant::Parallel || variant == Variant::ParallelSimd
+          ? ProcessingMode::Parallel
+          : ProcessingMode::Serial;
+  Timings timings{};
+
+  const auto measure = [&timings](const size_t phase, const auto &body) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    body();
+    const std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    timings[phase] = elapsed.count();
+  };
+
+  Stations stations;
+  measure(0, [&] {
+    stations = parse_stations(stations_content);
+    fill_measurements(stations, measurements_content,
+                      {.parallel = mode == ProcessingMode::Parallel});
+  });
+
+  std::unique_ptr<Stats> stats_calculator =
+      choose_by_mode<Stats, SerialStats, ParallelStats>(mode);
+  if (variant == Variant::Serial || variant == Variant::Parallel) {
+    stats_calculator->set_kernels(StatsKernels::Scalar);
+  }
+  std::vector<char> valid;
+  MonthlyStatsTable stats;
+  measure(1,
+          [&] { stats = stats_calculator->monthly_stats(stations, valid); });
+
+  const auto preprocessor =
+      choose_by_mode<Preprocessor, SerialPreprocessor, ParallelPreprocessor>(
+          mode);
+  measure(2, [&] {
+    preprocessor->preprocess_data(stations, stats, valid);
+    stations.shrink_to_fit();
+  });
+
+  // into memory, to measure the detection rather than the disk
+  const auto detector =
+      choose_by_mode<OutlierDetector, SerialOutlierDetector,
+                     ParallelOutlierDetector>(mode);
+  measure(3, [&] {
+    std::ostringstream outliers;
+    outliers << detector->rule().header() << '\n';
+    detector->find_outliers(stations, stats, outliers);
+  });
+
+  const auto renderer =
+      choose_by_mode<Renderer, SerialRenderer, ParallelRenderer>(mode);
+  measure(4, [&] { renderer->render_months(stations, stats); });
+
+  timings.back() = std::accumulate(timings.begin(), timings.end() - 1, 0.0);
+
+  return timings;
+}
+
+struct Summary {
+  double median;
+  double p95;
+  double mean;
+  double stddev;
+  double min;
+};
+
+Summary summarize(std::vector<double> samples) {
+  std::ranges::sort(samples);
+
+  const size_t count = samples.size();
+  const double mean =
+      std::accumulate(samples.begin(), samples.end(), 0.0) / count;
+
+  double squares = 0;
+  for (const double sample : samples) {
+    squares += (sample - mean) * (sample - mean);
+  }
+
+  const auto percentile = [&samples](const double p) {
+    // nearest rank
+    const auto rank = static_cast<size_t>(std::ceil(p * samples.size()));
+    return samples[std::clamp(rank, 1uz, samples.size()) - 1];
+  };
+
+  return {
+      .median = count % 2 == 1
+                    ? samples[count / 2]
+                    : (samples[count / 2 - 1] + samples[count / 2]) / 2,
+      .p95 = percentile(0.95),
+      .mean = mean,
+      .stddev = count > 1 ? std::sqrt(squares / (count - 1)) : 0,
+      .min = samples.front(),
+  };
+}
+
+struct Result {
+  Variant variant;
+  // threads taking part, the caller included, 1 for the serial variants
+  size_t threads;
+  std::array<Summary, PHASES.size()> phases;
+};
+
+Result benchmark(const BenchConfig &config, const Variant variant,
+                 const size_t threads, const std::string_view stations_content,
+                 const std::string_view measurements_content) {
+  for (size_t i = 0; i < config.warmup; i++) {
+    run_pipeline(variant, stations_content, measurements_content);
+  }
+
+  std::array<std::vector<double>, PHASES.size()> samples;
+  for (size_t i = 0; i < config.runs; i++) {
+    const auto timings =
+        run_pipeline(variant, stations_content, measurements_content);
+    for (size_t phase = 0; phase < PHASES.size(); phase++) {
+      samples[phase].push_back(timings[phase]);
+    }
+  }
+
+  Result result{variant, threads, {}};
+  for (size_t phase = 0; phase < PHASES.size(); phase++) {
+    result.phases[phase] = summarize(std::move(samples[phase]));
+  }
+  return result;
+}
+
+/**
+ * @brief Derived metrics of a parallel result compared to the serial one.
+ */
+struct Scaling {
+  double speedup;
+  // speedup per thread
+  double efficiency;
+  // experimentally determined serial fraction (Karp-Flatt metric), the `1 - P`
+  // of Amdahl's law
+  double serial_fraction;
+};
+
+Scaling scaling(const Summary &serial, const Summary &parallel,
+                const size_t threads) {
+  const double speedup = serial.median / parallel.median;
+  const double p = static_cast<double>(threads);
+  const double serial_fraction =
+      threads > 1 ? (1 / speedup - 1 / p) / (1 - 1 / p) : 1;
+
+  return {speedup, speedup / p, serial_fraction};
+}
+
+std::string_view variant_name(const Variant variant) {
+  switch (variant) {
+  case Variant::Serial:
+    return "serial";
+  case Variant::Simd:
+    return "simd";
+  case Variant::Parallel:
+    return "parallel";
+  case Variant::ParallelSimd:
+    return "parallel-simd";
+  }
+  return "unknown";
+}
+
+void print_table(std::ostream &out, const std::vector<Result> &results) {
+  out << std::format("{:<13} {:>7} {:<10} {:>11} {:>11} {:>11} {:>8} {:>6} "
+                     "{:>6}\n",
+                     "mode", "threads", "phase", "median[μs]", "p95[μs]",
+                     "stddev[μs]", "speedup", "η", "1-P");
+
+  for (const auto &result : results) {
+    for (size_t phase = 0; phase < PHASES.size(); phase++) {
+      const auto &summary = result.phases[phase];
+      const auto metrics =
+          scaling(results.front().phases[phase], summary, result.threads);
+
+      out << std::format("{:<13} {:>7} {:<10} {:>11.1f} {:>11.1f} {:>11.1f} "
+                         "{:>8.2f} {:>6.2f} {:>6.2f}\n",
+                         variant_name(result.variant), result.threads,
+                         PHASES[phase], summary.median, summary.p95,
+                         summary.stddev, metrics.speedup, metrics.efficiency,
+                         metrics.serial_fraction);
+    }
+  }
+}
+
+void print_csv(std::ostream &out, const std::vector<Result> &results) {
+  out << "mode,threads,phase,median_us,p95_us,mean_us,stddev_us,min_us,"
+         "speedup,efficiency,serial_fraction\n";
+
+  for (const auto &result : results) {
+    for (size_t phase = 0; phase < PHASES.size(); phase++) {
+      const auto &summary = result.phases[phase];
+      const auto metrics =
+          scaling(results.front().phases[phase], summary, result.threads);
+
+      out << std::format("{},{},{},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.4f},"
+                         "{:.4f},{:.4f}\n",
+                         variant_name(result.variant), result.threads,
+                         PHASES[phase], summary.median, summary.p95,
+                         summary.mean, summary.stddev, summary.min,
+                         metrics.speedup, metrics.efficiency,
+                         metrics.serial_fraction);
+    }
+  }
+}
+
+void print_json(std::ostream &out, const BenchConfig &config,
+                const std::vector<Result> &results) {
+  out << std::format("{{\n  \"runs\": {},\n  \"warmup\": {},\n"
+                     "  \"hardware_threads\": {},\n  \"pin\": \"{}\",\n"
+                     "  \"simd_kernels\": \"{}\",\n  \"results\": [",
+                     config.runs, config.warmup,
+                     std::thread::hardware_concurrency(), config.pin,
+                     Stats::simd_kernels());
+
+  bool first = true;
+  for (const auto &result : results) {
+    for (size_t phase = 0; phase < PHASES.size(); phase++) {
+      const auto &summary = result.phases[phase];
+      const auto metrics =
+          scaling(results.front().phases[phase], summary, result.threads);
+
+      out << std::format(
+          "{}\n    {{\"mode\": \"{}\", \"threads\": {}, \"phase\": \"{}\", "
+          "\"median_us\": {:.3f}, \"p95_us\": {:.3f}, \"mean_us\": {:.3f}, "
+          "\"stddev_us\": {:.3f}, \"min_us\": {:.3f}, \"speedup\": {:.4f}, "
+          "\"efficiency\": {:.4f}, \"serial_fraction\": {:.4f}}}",
+          first ? "" : ",", variant_name(result.variant), result.threads,
+          PHASES[phase], summary.median, summary.p95, summary.mean,
+          summary.stddev, summary.min, metrics.speedup, metrics.efficiency,
+          metrics.serial_fraction);
+      first = false;
+    }
+  }
+
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  try {
+    config = parse_arguments(argc, argv);
+  } catch (std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  const MappedFile stations_file(config.stations_file);
+  const MappedFile measurements_file(config.measurements_file);
+
+  std::filesystem::create_directories("output");
+
+  const auto measurements_content = measurements_file.view();
+
+  std::vector<Result> results;
+
+  std::cerr << "Benchmarking serial...\n";
+  results.push_back(benchmark(config, Variant::Serial, 1,
+                              stations_file.view(), measurements_content));
+
+  std::cerr << std::format("Benchmarking serial with {} statistics...\n",
+                           Stats::simd_kernels());
+  results.push_back(benchmark(config, Variant::Simd, 1, stations_file.view(),
+                              measurements_content));
+
+  for (const size_t threads : config.threads) {
+    std::cerr << std::format("Benchmarking parallel with {} threads...\n",
+                             threads);
+
+    // the calling thread takes part in the loops too
+    threadpool::pool.resize(threads - 1);
+    if (config.pin != topology::AffinityPolicy::None) {
+      threadpool::pool.pin(config.pin);
+    }
+
+    results.push_back(benchmark(config, Variant::Parallel, threads,
+                                stations_file.view(), measurements_content));
+
+    std::cerr << std::format(
+        "Benchmarking parallel with {} threads and {} statistics...\n",
+        threads, Stats::simd_kernels());
+    results.push_back(benchmark(config, Variant::ParallelSimd, threads,
+                                stations_file.view(), measurements_content));
+  }
+
+  threadpool::pool.join();
+
+  std::ofstream output_file;
+  if (config.output_file) {
+    output_file.open(*config.output_file);
+    if (!output_file.is_open()) {
+      std::cerr << "Failed to open output file." << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &out = config.output_file ? output_file : std::cout;
+
+  switch (config.format) {
+  case OutputFormat::Table:
+    print_table(out, results);
+    break;
+  case OutputFormat::Csv:
+    print_csv(out, results);
+    break;
+  case OutputFormat::Json:
+    print_json(out, config, results);
+    break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+// Microbenchmark of the per-task overhead of the threadpool: how long a spawn
+// takes and how many heap allocations it makes.
+
+#include "threadpool.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <vector>
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(const size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+constexpr size_t TASKS = 1'000'000;
+constexpr size_t ROUNDS = 5;
+
+/**
+ * @brief Runs `body` a few times and prints the best time and the number of
+ * allocations of the last round, both per task.
+ */
+void measure(const char *name, const auto &body) {
+  // warm up the caches of the pool
+  body();
+
+  double best = std::numeric_limits<double>::infinity();
+  size_t allocated = 0;
+
+  for (size_t round = 0; round < ROUNDS; round++) {
+    const size_t before = allocations.load();
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    body();
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    allocated = allocations.load() - before;
+
+    const std::chrono::duration<double, std::nano> elapsed = end - start;
+    best = std::min(best, elapsed.count() / TASKS);
+  }
+
+  std::cout << std::format("{:<28} {:>8.1f} ns/task {:>8.3f} allocs/task\n",
+                           name, best,
+                           static_cast<double>(allocated) / TASKS);
+}
+
+/**
+ * @brief Spawns `TASKS` tasks with the given capture from the calling thread
+ * and waits for them.
+ */
+template <size_t CaptureSize> void spawn_tasks() {
+  std::atomic<size_t> done{0};
+  std::array<char, CaptureSize> payload{};
+
+  for (size_t i = 0; i < TASKS; i++) {
+    threadpool::pool.spawn([&done, payload] {
+      static_cast<void>(payload);
+      if (done.fetch_add(1) + 1 == TASKS) {
+        done.notify_one();
+      }
+    });
+  }
+
+  for (size_t value; (value = done.load()) != TASKS;) {
+    done.wait(value);
+  }
+}
+
+/**
+ * @brief Spawns the tasks from inside a worker, so they go to its local deque
+ * instead of the injection queue.
+ */
+void spawn_nested() {
+  std::atomic<size_t> done{0};
+
+  threadpool::pool.spawn([&done] {
+    for (size_t i = 0; i < TASKS; i++) {
+      threadpool::pool.spawn([&done] {
+        if (done.fetch_add(1) + 1 == TASKS) {
+          done.notify_one();
+        }
+      });
+    }
+  });
+
+  for (size_t value; (value = done.load()) != TASKS;) {
+    done.wait(value);
+  }
+}
+
+/**
+ * @brief Spawns tasks with futures in batches and collects the results.
+ */
+void spawn_futures() {
+  constexpr size_t BATCH = 1024;
+
+  std::vector<threadpool::future<size_t>> futures;
+  futures.reserve(BATCH);
+
+  size_t sum = 0;
+  for (size_t i = 0; i < TASKS; i += BATCH) {
+    for (size_t j = 0; j < BATCH; j++) {
+      futures.push_back(threadpool::pool.spawn_with_future([j] { return j; }));
+    }
+    for (auto &future : futures) {
+      sum += future.get();
+    }
+    futures.clear();
+  }
+
+  if (sum == 0) {
+    std::cout << "unreachable\n";
+  }
+}
+
+int main() {
+  std::cout << std::format("Threadpool with {} threads, {} tasks per round\n",
+                           threadpool::pool.size(), TASKS);
+
+  measure("spawn (16 B capture)", spawn_tasks<8>);
+  measure("spawn (40 B capture)", spawn_tasks<32>);
+  measure("spawn (72 B capture, heap)", spawn_tasks<64>);
+  measure("spawn from worker", spawn_nested);
+  measure("spawn_with_future + get", spawn_futures);
+
+  threadpool::pool.join();
+}
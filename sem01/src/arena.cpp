@@ -0,0 +1,14 @@
+#include "arena.hpp"
+#include <algorithm>
+
+namespace arena {
+
+Arena::Arena(const size_t capacity)
+    : mResource(std::max(capacity, size_t{1})) {}
+
+void *Arena::allocate(const size_t size, const size_t alignment) {
+  std::lock_guard lock{mMutex};
+  return mResource.allocate(size, alignment);
+}
+
+} // namespace arena
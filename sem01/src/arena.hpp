@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Arena allocation of the data model.
+ *
+ * The columns of the measurements of all stations are allocated with their
+ * exact sizes, counted before parsing, from a single `Arena`, instead of
+ * growing each of them by doubling (which copies them over and over and
+ * leaves the peak memory at about twice the data). Nothing is freed on its
+ * own, the whole arena is released at once when the last container using it
+ * is destroyed.
+ */
+namespace arena {
+
+/**
+ * @class Arena
+ * @brief Monotonic allocator handing out memory from a few large blocks.
+ *
+ * Thread-safe. There are only a few allocations per station, so a mutex is
+ * cheap enough.
+ */
+class Arena {
+public:
+  /**
+   * @param capacity Size of the first block in bytes, ideally enough for
+   * everything that will be allocated. More blocks are added if it isn't.
+   */
+  explicit Arena(size_t capacity);
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t size, size_t alignment);
+
+private:
+  std::mutex mMutex;
+  std::pmr::monotonic_buffer_resource mResource;
+};
+
+/**
+ * @class Allocator
+ * @brief Allocator of the containers of the data model, from an arena shared
+ * by all of them, or from the heap when default-constructed.
+ *
+ * Moving a container moves its memory along with the allocator, so the data
+ * can be moved around (e.g. when discarding stations) without copying it out
+ * of the arena.
+ */
+template <typename T> class Allocator {
+public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  Allocator() = default;
+  explicit Allocator(std::shared_ptr<Arena> arena) : mArena(std::move(arena)) {}
+
+  template <typename U>
+  Allocator(const Allocator<U> &other) : mArena(other.mArena) {}
+
+  T *allocate(const size_t count) {
+    if (!mArena) {
+      return std::allocator<T>{}.allocate(count);
+    }
+    return static_cast<T *>(mArena->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *pointer, const size_t count) {
+    // the memory of the arena is only freed with the arena
+    if (!mArena) {
+      std::allocator<T>{}.deallocate(pointer, count);
+    }
+  }
+
+  template <typename U> bool operator==(const Allocator<U> &other) const {
+    return mArena == other.mArena;
+  }
+
+private:
+  template <typename> friend class Allocator;
+
+  std::shared_ptr<Arena> mArena;
+};
+
+template <typename T> using Vector = std::vector<T, Allocator<T>>;
+
+using String = std::basic_string<char, std::char_traits<char>, Allocator<char>>;
+
+} // namespace arena
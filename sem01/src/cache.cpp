@@ -0,0 +1,252 @@
+#include "cache.hpp"
+#include "mapped_file.hpp"
+#include "parsing.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ranges>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+namespace cache {
+
+constexpr std::array<char, 8> MAGIC = {'M', 'E', 'T', 'E', 'O', 'C', 'C', 'H'};
+constexpr uint32_t VERSION = 1;
+
+struct Header {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t padding;
+  FileStamp stations_source;
+  FileStamp measurements_source;
+  uint64_t station_count;
+  uint64_t measurement_count;
+  uint64_t names_size;
+};
+
+struct StationEntry {
+  uint64_t id;
+  double latitude;
+  double longitude;
+  uint64_t name_offset;
+  uint64_t name_size;
+  uint64_t first_measurement;
+  uint64_t measurement_count;
+};
+
+static_assert(std::is_trivially_copyable_v<Header> &&
+              std::is_trivially_copyable_v<StationEntry>);
+
+/**
+ * @brief Byte offsets of the sections of the cache file.
+ */
+struct Layout {
+  size_t stations;
+  size_t names;
+  size_t ordinals;
+  size_t values;
+  size_t years;
+  size_t months;
+  size_t days;
+  size_t end;
+
+  explicit Layout(const Header &header) {
+    const size_t count = header.measurement_count;
+
+    stations = sizeof(Header);
+    names = stations + header.station_count * sizeof(StationEntry);
+    // keep the 8-byte columns aligned
+    ordinals = (names + header.names_size + 7) & ~size_t{7};
+    values = ordinals + count * sizeof(size_t);
+    years = values + count * sizeof(Temperature);
+    months = years + count * sizeof(Year);
+    days = months + count * sizeof(Month);
+    end = days + count * sizeof(Day);
+  }
+};
+
+std::optional<FileStamp> stamp(const std::filesystem::path &file) {
+  std::error_code error;
+
+  const auto size = std::filesystem::file_size(file, error);
+  if (error) {
+    return std::nullopt;
+  }
+
+  const auto modified = std::filesystem::last_write_time(file, error);
+  if (error) {
+    return std::nullopt;
+  }
+
+  return FileStamp{size, modified.time_since_epoch().count()};
+}
+
+std::optional<Stations> load(const std::filesystem::path &cache_file,
+                             const std::filesystem::path &stations_file,
+                             const std::filesystem::path &measurements_file) {
+  std::error_code error;
+  if (!std::filesystem::exists(cache_file, error)) {
+    return std::nullopt;
+  }
+
+  std::optional<MappedFile> file;
+  try {
+    file.emplace(cache_file);
+  } catch (const std::runtime_error &) {
+    return std::nullopt;
+  }
+
+  const char *data = file->view().data();
+
+  Header header;
+  if (file->size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, data, sizeof(header));
+
+  if (header.magic != MAGIC || header.version != VERSION) {
+    return std::nullopt;
+  }
+
+  if (stamp(stations_file) != header.stations_source ||
+      stamp(measurements_file) != header.measurements_source) {
+    return std::nullopt;
+  }
+
+  const Layout layout(header);
+  if (layout.end != file->size()) {
+    return std::nullopt;
+  }
+
+  std::vector<StationEntry> entries(header.station_count);
+  std::memcpy(entries.data(), data + layout.stations,
+              entries.size() * sizeof(StationEntry));
+
+  const arena::Allocator<char> names_allocator(
+      std::make_shared<arena::Arena>(header.names_size));
+
+  Stations stations;
+  stations.reserve(header.station_count);
+  std::vector<size_t> counts;
+  counts.reserve(header.station_count);
+
+  for (const auto &entry : entries) {
+    if (entry.name_offset + entry.name_size > header.names_size ||
+        entry.first_measurement + entry.measurement_count >
+            header.measurement_count) {
+      return std::nullopt;
+    }
+
+    stations.emplace_back(
+        entry.id,
+        arena::String(data + layout.names + entry.name_offset,
+                      entry.name_size, names_allocator),
+        std::make_pair(entry.latitude, entry.longitude));
+    counts.push_back(entry.measurement_count);
+  }
+
+  // all columns in one arena of the exact size
+  allocate_measurements(stations, counts);
+
+  const auto read_column = [data](auto &column, const size_t offset,
+                                  const StationEntry &entry) {
+    using T = typename std::remove_cvref_t<decltype(column)>::value_type;
+    column.resize(entry.measurement_count);
+    std::memcpy(column.data(), data + offset + entry.first_measurement * sizeof(T),
+                entry.measurement_count * sizeof(T));
+  };
+
+  for (const auto &[station, entry] : std::views::zip(stations, entries)) {
+    auto &measurements = station.measurements;
+    read_column(measurements.ordinals, layout.ordinals, entry);
+    read_column(measurements.values, layout.values, entry);
+    read_column(measurements.years, layout.years, entry);
+    read_column(measurements.months, layout.months, entry);
+    read_column(measurements.days, layout.days, entry);
+  }
+
+  return stations;
+}
+
+void save(const std::filesystem::path &cache_file,
+          const std::filesystem::path &stations_file,
+          const std::filesystem::path &measurements_file,
+          const Stations &stations) {
+  const auto stations_source = stamp(stations_file);
+  const auto measurements_source = stamp(measurements_file);
+
+  if (!stations_source || !measurements_source) {
+    throw std::runtime_error("Failed to stat input files.");
+  }
+
+  Header header{MAGIC, VERSION, 0, *stations_source, *measurements_source,
+                stations.size(), 0, 0};
+
+  for (const auto &station : stations) {
+    header.measurement_count += station.measurements.size();
+    header.names_size += station.name.size();
+  }
+
+  const Layout layout(header);
+
+  auto temporary_file = cache_file;
+  temporary_file += ".tmp";
+
+  std::ofstream file(temporary_file, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open cache file.");
+  }
+
+  const auto write = [&file](const void *data, const size_t size) {
+    file.write(static_cast<const char *>(data), size);
+  };
+
+  write(&header, sizeof(header));
+
+  size_t name_offset = 0;
+  size_t first_measurement = 0;
+  for (const auto &station : stations) {
+    const StationEntry entry{station.id,
+                             station.location.first,
+                             station.location.second,
+                             name_offset,
+                             station.name.size(),
+                             first_measurement,
+                             station.measurements.size()};
+    write(&entry, sizeof(entry));
+
+    name_offset += station.name.size();
+    first_measurement += station.measurements.size();
+  }
+
+  for (const auto &station : stations) {
+    write(station.name.data(), station.name.size());
+  }
+
+  constexpr std::array<char, 8> PADDING{};
+  write(PADDING.data(), layout.ordinals - (layout.names + header.names_size));
+
+  const auto write_column = [&](const auto member) {
+    for (const auto &station : stations) {
+      const auto &column = station.measurements.*member;
+      write(column.data(), column.size() * sizeof(column[0]));
+    }
+  };
+
+  write_column(&Measurements::ordinals);
+  write_column(&Measurements::values);
+  write_column(&Measurements::years);
+  write_column(&Measurements::months);
+  write_column(&Measurements::days);
+
+  file.close();
+  if (file.fail()) {
+    throw std::runtime_error("Failed to write cache file.");
+  }
+
+  std::filesystem::rename(temporary_file, cache_file);
+}
+
+} // namespace cache
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "data.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+/**
+ * Binary cache of the parsed input files.
+ *
+ * Layout of the file (all values in native byte order):
+ *
+ * - header: magic, format version, size and modification time of both source
+ *   files, and the number of stations, measurements and name bytes
+ * - station table: id, location, name slice and measurement slice of each
+ *   station
+ * - station names, concatenated
+ * - measurement columns of all stations concatenated, ordered by alignment:
+ *   ordinals, values, years, months, days
+ *
+ * The cache is only used when both source files still have the size and
+ * modification time recorded in the header, otherwise it is rebuilt.
+ */
+namespace cache {
+
+/**
+ * @brief Identity of a source file, to tell whether it changed.
+ */
+struct FileStamp {
+  uint64_t size;
+  int64_t modified;
+
+  bool operator==(const FileStamp &) const = default;
+};
+
+/**
+ * @brief Size and modification time of the file, if it exists.
+ */
+std::optional<FileStamp> stamp(const std::filesystem::path &file);
+
+/**
+ * @brief Loads the stations from the cache.
+ *
+ * @return The stations, or `std::nullopt` if the cache doesn't exist, is
+ * damaged, has a different version, or either source file changed since it
+ * was written.
+ */
+std::optional<Stations> load(const std::filesystem::path &cache_file,
+                             const std::filesystem::path &stations_file,
+                             const std::filesystem::path &measurements_file);
+
+/**
+ * @brief Writes the parsed (not yet preprocessed) stations to the cache.
+ *
+ * The file is written under a temporary name and then renamed, so a
+ * concurrent run never sees a partially written cache.
+ *
+ * @throws std::runtime_error if the file cannot be written.
+ */
+void save(const std::filesystem::path &cache_file,
+          const std::filesystem::path &stations_file,
+          const std::filesystem::path &measurements_file,
+          const Stations &stations);
+
+} // namespace cache
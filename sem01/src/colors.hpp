@@ -1,3 +1,5 @@
+#pragma once
+
 /* Adapted from my project for the Introduction to Computer Graphics course. */
 
 struct Color {
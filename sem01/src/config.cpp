@@ -1,27 +1,144 @@
 #include "config.hpp"
+#include <algorithm>
+#include <charconv>
 #include <format>
+#include <limits>
+#include <ranges>
 #include <string>
+#include <vector>
+
+size_t parse_positive(std::string_view text, const bool allow_suffix) {
+  const std::string_view argument = text;
+  size_t multiplier = 1;
+  if (allow_suffix && !text.empty()) {
+    switch (text.back()) {
+    case 'K':
+      multiplier = 1024;
+      break;
+    case 'M':
+      multiplier = 1024 * 1024;
+      break;
+    case 'G':
+      multiplier = 1024 * 1024 * 1024;
+      break;
+    }
+    if (multiplier != 1) {
+      text.remove_suffix(1);
+    }
+  }
+
+  size_t value = 0;
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+
+  if (error != std::errc{} || end != text.data() + text.size() || value == 0) {
+    throw std::invalid_argument(
+        std::format("Expected a positive number, got '{}'.", text));
+  }
+
+  if (value > std::numeric_limits<size_t>::max() / multiplier) {
+    throw std::invalid_argument(
+        std::format("The number '{}' is too large.", argument));
+  }
+
+  return value * multiplier;
+}
 
 Config::Config(const int argc, const char *const argv[]) {
   const auto usage_message = [&argv]() {
-    return std::format("Usage: {} --serial|parallel <input_file>",
-                       std::string(argv[0]));
+    return std::format(
+        "Usage: {} --serial|parallel [--huge-pages] [--stream] "
+        "[--cache <cache_file>] [--incremental <state_file>] "
+        "[--threads <count>] [--pin <policy>] [--chunk-size <bytes>] "
+        "[--phase-threads <phase>=<count>,...] [--counters] "
+        "[--detector <rule>] [--renderer <format>] [--trace <trace_file>] "
+        "<stations_file> <measurements_file>",
+        std::string(argv[0]));
   };
 
-  if (argc < 3) {
-    throw std::invalid_argument(usage_message());
+  const auto next_value = [&](int &i) {
+    if (++i == argc) {
+      throw std::invalid_argument(usage_message());
+    }
+    return std::string_view(argv[i]);
+  };
+
+  bool has_mode = false;
+  std::vector<std::string> positional;
+
+  for (int i = 1; i < argc; i++) {
+    auto arg = std::string(argv[i]);
+    if (arg == "--serial") {
+      mMode = ProcessingMode::Serial;
+      has_mode = true;
+    } else if (arg == "--parallel") {
+      mMode = ProcessingMode::Parallel;
+      has_mode = true;
+    } else if (arg == "--huge-pages") {
+      mHugePages = true;
+    } else if (arg == "--stream") {
+      mStream = true;
+    } else if (arg == "--cache") {
+      mCacheFile = std::filesystem::path(next_value(i));
+    } else if (arg == "--incremental") {
+      mIncrementalFile = std::filesystem::path(next_value(i));
+    } else if (arg == "--threads") {
+      mThreads = parse_positive(next_value(i), false);
+    } else if (arg == "--pin") {
+      mPin = topology::parse_policy(next_value(i));
+    } else if (arg == "--chunk-size") {
+      mChunkSize = parse_positive(next_value(i), true);
+    } else if (arg == "--phase-threads") {
+      // e.g. `stats=8,render=2`
+      for (const auto part : std::views::split(next_value(i), ',')) {
+        const std::string_view item(part.begin(), part.end());
+        const size_t equals = item.find('=');
+        const auto phase =
+            std::ranges::find(PHASE_NAMES, item.substr(0, equals));
+
+        if (equals == std::string_view::npos || phase == PHASE_NAMES.end()) {
+          throw std::invalid_argument(std::format(
+              "Invalid phase thread count '{}', expected <phase>=<count> "
+              "with phase one of parse, preprocess, stats, outliers, render.",
+              item));
+        }
+
+        mPhaseThreads[phase - PHASE_NAMES.begin()] =
+            parse_positive(item.substr(equals + 1), false);
+      }
+    } else if (arg == "--counters") {
+      mCounters = true;
+    } else if (arg == "--detector") {
+      mDetector = parse_rule(next_value(i));
+    } else if (arg == "--renderer") {
+      mRenderer = parse_renderer(next_value(i));
+    } else if (arg == "--trace") {
+      mTraceFile = std::filesystem::path(next_value(i));
+    } else if (arg.starts_with("--")) {
+      throw std::invalid_argument(usage_message());
+    } else {
+      positional.push_back(std::move(arg));
+    }
   }
 
-  auto mode_arg = std::string(argv[1]);
-  if (mode_arg == "--serial") {
-    mMode = ProcessingMode::Serial;
-  } else if (mode_arg == "--parallel") {
-    mMode = ProcessingMode::Parallel;
-  } else {
+  if (!has_mode || positional.size() != 2) {
     throw std::invalid_argument(usage_message());
   }
 
-  auto stations_file_arg = std::filesystem::path(argv[2]);
+  // the incremental state replaces both of them
+  if (mIncrementalFile && (mCacheFile || mStream)) {
+    throw std::invalid_argument(
+        "--incremental can't be combined with --cache or --stream.");
+  }
+
+  // the state only keeps the monthly aggregates
+  if (mIncrementalFile && mDetector == OutlierRuleKind::Spike) {
+    throw std::invalid_argument(
+        "--detector spike needs the measurements, which --incremental "
+        "doesn't keep.");
+  }
+
+  auto stations_file_arg = std::filesystem::path(positional[0]);
 
   if (!std::filesystem::exists(stations_file_arg)) {
     throw std::invalid_argument("Stations file does not exist");
@@ -29,7 +146,7 @@ Config::Config(const int argc, const char *const argv[]) {
 
   mStationsFile = stations_file_arg;
 
-  auto measurements_file_arg = std::filesystem::path(argv[3]);
+  auto measurements_file_arg = std::filesystem::path(positional[1]);
 
   if (!std::filesystem::exists(measurements_file_arg)) {
     throw std::invalid_argument("Measurements file does not exist");
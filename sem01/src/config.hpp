@@ -1,11 +1,26 @@
 #pragma once
 
+#include "outliers.hpp"
+#include "parsing.hpp"
+#include "renderer.hpp"
 #include "threadpool.hpp"
+#include "topology.hpp"
+#include <array>
 #include <filesystem>
 #include <format>
+#include <optional>
+#include <string_view>
 
 enum ProcessingMode { Serial, Parallel };
 
+/**
+ * @brief Parallel phases whose thread count can be limited separately.
+ */
+enum class Phase { Parsing, Preprocessing, Stats, Outliers, Rendering };
+
+constexpr std::array<std::string_view, 5> PHASE_NAMES = {
+    "parse", "preprocess", "stats", "outliers", "render"};
+
 template <> struct std::formatter<ProcessingMode> {
   constexpr auto parse(std::format_parse_context const &ctx) const {
     return ctx.begin();
@@ -15,18 +30,58 @@ template <> struct std::formatter<ProcessingMode> {
     if (p == ProcessingMode::Serial) {
       return std::format_to(ctx.out(), "serial");
     } else {
+      // the calling thread takes part in the loops too
       return std::format_to(ctx.out(), "parallel ({} threads)",
-                            threadpool::pool.size());
+                            threadpool::pool.size() + 1);
     }
   }
 };
 
+/**
+ * @brief Parses a positive number, optionally with a binary `K`, `M` or `G`
+ * suffix.
+ *
+ * @throws std::invalid_argument if the number is invalid, zero or doesn't fit
+ * into `size_t`.
+ */
+size_t parse_positive(std::string_view text, bool allow_suffix);
+
 class Config {
 public:
   Config() = default;
   Config(const int argc, const char *const argv[]);
 
   ProcessingMode mode() const { return mMode; }
+  bool huge_pages() const { return mHugePages; }
+  bool stream() const { return mStream; }
+  // number of threads, the calling one included, 0 for the default
+  size_t threads() const { return mThreads; }
+  topology::AffinityPolicy pin() const { return mPin; }
+  // 0 for the default of the parsing mode
+  size_t chunk_size() const { return mChunkSize; }
+  // maximum number of threads of the phase, 0 for the whole pool
+  size_t phase_threads(const Phase phase) const {
+    return mPhaseThreads[static_cast<size_t>(phase)];
+  }
+  ParsingOptions parsing_options() const {
+    return {mMode == ProcessingMode::Parallel, mChunkSize,
+            phase_threads(Phase::Parsing)};
+  }
+  const std::optional<std::filesystem::path> &cache_file() const {
+    return mCacheFile;
+  }
+  // state of the incremental mode, if enabled
+  const std::optional<std::filesystem::path> &incremental_file() const {
+    return mIncrementalFile;
+  }
+  // whether to print the hardware counters of the phases
+  bool counters() const { return mCounters; }
+  OutlierRuleKind detector() const { return mDetector; }
+  RendererKind renderer() const { return mRenderer; }
+  // Chrome trace of the phases and tasks to write, if any
+  const std::optional<std::filesystem::path> &trace_file() const {
+    return mTraceFile;
+  }
   const std::filesystem::path &stations_file() const { return mStationsFile; }
   const std::filesystem::path &measurements_file() const {
     return mMeasurementsFile;
@@ -34,6 +89,18 @@ public:
 
 private:
   ProcessingMode mMode;
+  bool mHugePages = false;
+  bool mStream = false;
+  size_t mThreads = 0;
+  topology::AffinityPolicy mPin = topology::AffinityPolicy::None;
+  size_t mChunkSize = 0;
+  std::array<size_t, PHASE_NAMES.size()> mPhaseThreads{};
+  std::optional<std::filesystem::path> mCacheFile;
+  std::optional<std::filesystem::path> mIncrementalFile;
+  bool mCounters = false;
+  OutlierRuleKind mDetector = OutlierRuleKind::Jump;
+  RendererKind mRenderer = RendererKind::Svg;
+  std::optional<std::filesystem::path> mTraceFile;
   std::filesystem::path mStationsFile;
   std::filesystem::path mMeasurementsFile;
 
@@ -46,9 +113,41 @@ template <> struct std::formatter<Config> {
   }
   template <typename FormatContext>
   auto format(const Config &config, FormatContext &ctx) const {
-    return std::format_to(
-        ctx.out(), "Config:\n\tmode: {}\n\tstations: {}\n\tmeasurements: {}\n",
+    auto out = std::format_to(
+        ctx.out(),
+        "Config:\n\tmode: {}\n\tstations: {}\n\tmeasurements: {}\n"
+        "\thuge pages: {}\n\tstreaming: {}\n\tcache: {}\n\tincremental: {}\n"
+        "\tcounters: {}\n\tdetector: {}\n\trenderer: {}\n\ttrace: {}\n",
         config.mMode, config.mStationsFile.string(),
-        config.mMeasurementsFile.string());
+        config.mMeasurementsFile.string(), config.mHugePages, config.mStream,
+        config.mCacheFile ? config.mCacheFile->string() : "none",
+        config.mIncrementalFile ? config.mIncrementalFile->string() : "none",
+        config.mCounters, config.mDetector, config.mRenderer,
+        config.mTraceFile ? config.mTraceFile->string() : "none");
+
+    if (config.mMode == ProcessingMode::Serial) {
+      return out;
+    }
+
+    // report the values in effect, not the requested ones
+    const auto &pool = threadpool::pool;
+    const size_t default_chunk_size =
+        config.mStream ? DEFAULT_BLOCK_SIZE : DEFAULT_CHUNK_SIZE;
+
+    out = std::format_to(
+        out, "\tpinning: {}\n\tchunk size: {} B\n\tthreads per phase:",
+        pool.affinity(),
+        config.mChunkSize != 0 ? config.mChunkSize : default_chunk_size);
+
+    for (size_t i = 0; i < PHASE_NAMES.size(); i++) {
+      // the calling thread takes part in the loops too
+      const size_t limit = config.mPhaseThreads[i];
+      const size_t threads =
+          limit != 0 ? std::min(limit, pool.size() + 1) : pool.size() + 1;
+      out = std::format_to(out, " {} {}{}", PHASE_NAMES[i], threads,
+                           i + 1 < PHASE_NAMES.size() ? "," : "\n");
+    }
+
+    return out;
   }
 };
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "arena.hpp"
 #include <algorithm>
 #include <array>
 #include <cstddef>
+#include <limits>
+#include <memory>
+#include <span>
 #include <string>
 #include <utility>
 #include <vector>
@@ -21,11 +25,83 @@ struct Measurement {
   Temperature value;
 };
 
+/**
+ * @brief Measurements of a single station stored by columns.
+ *
+ * Most of the processing only looks at one or two of the fields, so keeping
+ * each of them contiguous means the scans only stream the bytes they need and
+ * the loops over them can be vectorized.
+ */
+struct Measurements {
+  arena::Vector<size_t> ordinals;
+  arena::Vector<Year> years;
+  arena::Vector<Month> months;
+  arena::Vector<Day> days;
+  arena::Vector<Temperature> values;
+
+  // bytes of all columns per measurement
+  static constexpr size_t ROW_SIZE = sizeof(size_t) + sizeof(Year) +
+                                     sizeof(Month) + sizeof(Day) +
+                                     sizeof(Temperature);
+
+  Measurements() = default;
+
+  /**
+   * @brief Empty columns allocated from the arena of the allocator.
+   */
+  explicit Measurements(const arena::Allocator<std::byte> &allocator)
+      : ordinals(allocator), years(allocator), months(allocator),
+        days(allocator), values(allocator) {}
+
+  size_t size() const { return values.size(); }
+  bool empty() const { return values.empty(); }
+
+  void reserve(const size_t size) {
+    ordinals.reserve(size);
+    years.reserve(size);
+    months.reserve(size);
+    days.reserve(size);
+    values.reserve(size);
+  }
+
+  void resize(const size_t size) {
+    ordinals.resize(size);
+    years.resize(size);
+    months.resize(size);
+    days.resize(size);
+    values.resize(size);
+  }
+
+  void shrink_to_fit() {
+    ordinals.shrink_to_fit();
+    years.shrink_to_fit();
+    months.shrink_to_fit();
+    days.shrink_to_fit();
+    values.shrink_to_fit();
+  }
+
+  void emplace_back(const size_t ordinal, const Year year, const Month month,
+                    const Day day, const Temperature value) {
+    ordinals.push_back(ordinal);
+    years.push_back(year);
+    months.push_back(month);
+    days.push_back(day);
+    values.push_back(value);
+  }
+
+  /**
+   * @brief Gathers all fields of a single measurement.
+   */
+  Measurement operator[](const size_t i) const {
+    return {ordinals[i], years[i], months[i], days[i], values[i]};
+  }
+};
+
 struct Station {
   size_t id;
-  std::string name;
+  arena::String name;
   std::pair<double, double> location;
-  std::vector<Measurement> measurements;
+  Measurements measurements;
 };
 
 using Stations = std::vector<Station>;
@@ -35,14 +111,113 @@ struct Outlier {
   Month month;
   Year year;
   Temperature difference;
+  // 0 for an outlier of a whole month
+  Day day = 0;
 };
 
 using Outliers = std::vector<Outlier>;
 
-using MonthlyAverage = std::pair<Year, Temperature>;
-using MonthlyAverages = std::vector<MonthlyAverage>;
-using StationMonthlyAverages = std::array<MonthlyAverages, 12>;
 using StationMonthlyMinmaxes =
     std::array<std::ranges::minmax_result<Temperature>, 12>;
-using StationMonthlyStats =
-    std::pair<StationMonthlyAverages, StationMonthlyMinmaxes>;
+
+/**
+ * @brief Monthly averages of a station by year, with the minimum and maximum
+ * of the averages of each month.
+ *
+ * The averages are a dense matrix of the 12 months by the years from
+ * `first_year` on, with NaN for the months without any measurements. It's
+ * only a view into the storage of the `MonthlyStatsTable` it belongs to, so
+ * copying it is cheap.
+ */
+struct StationMonthlyStats {
+  Year first_year = 0;
+  size_t years = 0;
+  // row by month, each `years` long
+  Temperature *averages = nullptr;
+  StationMonthlyMinmaxes minmaxes;
+
+  /**
+   * @brief Averages of the month by year, starting with `first_year`.
+   *
+   * @param index Index of the month, 0 for January.
+   */
+  std::span<const Temperature> month_averages(const size_t index) const {
+    return {averages + index * years, years};
+  }
+
+  Temperature &average(const Year year, const Month month) {
+    return averages[(month - 1) * years + (year - first_year)];
+  }
+
+  /**
+   * @brief Marks all months as without measurements.
+   */
+  void clear() {
+    std::fill_n(averages, 12 * years,
+                std::numeric_limits<Temperature>::quiet_NaN());
+    minmaxes.fill({std::numeric_limits<Temperature>::infinity(),
+                   -std::numeric_limits<Temperature>::infinity()});
+  }
+};
+
+/**
+ * @class MonthlyStatsTable
+ * @brief Monthly stats of all stations, with the averages of all of them in a
+ * single allocation.
+ *
+ * Move-only, so the stats are never copied by accident. Moving keeps the
+ * views valid.
+ */
+class MonthlyStatsTable {
+public:
+  MonthlyStatsTable() = default;
+
+  /**
+   * @brief Allocates the averages of stations measuring over the given
+   * ranges of years (inclusive, an empty one for no measurements).
+   *
+   * The averages are left uninitialized for the calculation to `clear` them
+   * in its pass over the station, so they are first touched by the thread
+   * that fills them.
+   */
+  explicit MonthlyStatsTable(
+      const std::span<const std::pair<Year, Year>> year_ranges)
+      : mStations(year_ranges.size()) {
+    size_t size = 0;
+    for (size_t i = 0; i < year_ranges.size(); i++) {
+      const auto [first_year, last_year] = year_ranges[i];
+      mStations[i].first_year = first_year;
+      mStations[i].years =
+          last_year >= first_year ? last_year - first_year + 1 : 0;
+      size += 12 * mStations[i].years;
+    }
+
+    mAverages = std::make_unique_for_overwrite<Temperature[]>(size);
+
+    size_t offset = 0;
+    for (auto &station : mStations) {
+      station.averages = mAverages.get() + offset;
+      offset += 12 * station.years;
+    }
+  }
+
+  size_t size() const { return mStations.size(); }
+
+  StationMonthlyStats &operator[](const size_t i) { return mStations[i]; }
+  const StationMonthlyStats &operator[](const size_t i) const {
+    return mStations[i];
+  }
+
+  auto begin() const { return mStations.cbegin(); }
+  auto end() const { return mStations.cend(); }
+
+  /**
+   * @brief Stats of the stations, to remove some of them. The averages of the
+   * removed ones stay allocated until the table is destroyed.
+   */
+  std::vector<StationMonthlyStats> &stations() { return mStations; }
+
+private:
+  std::unique_ptr<Temperature[]> mAverages;
+  std::vector<StationMonthlyStats> mStations;
+};
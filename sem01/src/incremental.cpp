@@ -0,0 +1,303 @@
+#include "incremental.hpp"
+#include "cache.hpp"
+#include "mapped_file.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+namespace incremental {
+
+using std::operator""sv;
+
+constexpr std::array<char, 8> MAGIC = {'M', 'E', 'T', 'E', 'O', 'I', 'N', 'C'};
+constexpr uint32_t VERSION = 1;
+
+// bytes hashed at each end of the processed part of the measurements
+constexpr size_t FINGERPRINT_SIZE = 4096;
+
+struct Header {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t padding;
+  cache::FileStamp stations_source;
+  uint64_t offset;
+  uint64_t head_hash;
+  uint64_t tail_hash;
+  uint64_t station_count;
+  uint64_t month_count;
+};
+
+struct StationEntry {
+  uint64_t id;
+  uint64_t first_month;
+  uint64_t month_count;
+};
+
+static_assert(std::is_trivially_copyable_v<Header> &&
+              std::is_trivially_copyable_v<StationEntry> &&
+              std::is_trivially_copyable_v<MonthAggregate>);
+
+/**
+ * @brief FNV-1a hash of the bytes.
+ */
+uint64_t hash(const std::string_view bytes) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const char byte : bytes) {
+    hash = (hash ^ static_cast<unsigned char>(byte)) * 0x100000001b3;
+  }
+  return hash;
+}
+
+/**
+ * @brief Hashes of the beginning and of the end of the processed part, which
+ * change if the file is rewritten rather than appended to.
+ */
+std::pair<uint64_t, uint64_t> fingerprint(const std::string_view measurements,
+                                          const size_t offset) {
+  const size_t size = std::min(offset, FINGERPRINT_SIZE);
+  return {hash(measurements.substr(0, size)),
+          hash(measurements.substr(offset - size, size))};
+}
+
+State::State(const Stations &stations) {
+  mStations.reserve(stations.size());
+  for (const auto &station : stations) {
+    mStations.push_back({station.id, {}});
+  }
+}
+
+std::optional<State> State::load(const std::filesystem::path &state_file,
+                                 const std::filesystem::path &stations_file,
+                                 const std::string_view measurements) {
+  std::error_code error;
+  if (!std::filesystem::exists(state_file, error)) {
+    return std::nullopt;
+  }
+
+  std::optional<MappedFile> file;
+  try {
+    file.emplace(state_file);
+  } catch (const std::runtime_error &) {
+    return std::nullopt;
+  }
+
+  const char *data = file->view().data();
+
+  Header header;
+  if (file->size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, data, sizeof(header));
+
+  if (header.magic != MAGIC || header.version != VERSION ||
+      cache::stamp(stations_file) != header.stations_source ||
+      header.offset > measurements.size() ||
+      fingerprint(measurements, header.offset) !=
+          std::pair(header.head_hash, header.tail_hash)) {
+    return std::nullopt;
+  }
+
+  const size_t months_offset =
+      sizeof(Header) + header.station_count * sizeof(StationEntry);
+  if (months_offset + header.month_count * sizeof(MonthAggregate) !=
+      file->size()) {
+    return std::nullopt;
+  }
+
+  State state;
+  state.mOffset = header.offset;
+  state.mStations.reserve(header.station_count);
+
+  for (size_t i = 0; i < header.station_count; i++) {
+    StationEntry entry;
+    std::memcpy(&entry, data + sizeof(Header) + i * sizeof(entry),
+                sizeof(entry));
+
+    if (entry.first_month + entry.month_count > header.month_count) {
+      return std::nullopt;
+    }
+
+    auto &station = state.mStations.emplace_back(entry.id);
+    station.months.resize(entry.month_count);
+    std::memcpy(station.months.data(),
+                data + months_offset +
+                    entry.first_month * sizeof(MonthAggregate),
+                entry.month_count * sizeof(MonthAggregate));
+  }
+
+  return state;
+}
+
+void State::save(const std::filesystem::path &state_file,
+                 const std::filesystem::path &stations_file,
+                 const std::string_view measurements) const {
+  const auto stations_source = cache::stamp(stations_file);
+  if (!stations_source) {
+    throw std::runtime_error("Failed to stat the stations file.");
+  }
+
+  const auto [head_hash, tail_hash] = fingerprint(measurements, mOffset);
+
+  Header header{MAGIC,     VERSION,   0, *stations_source, mOffset,
+                head_hash, tail_hash, mStations.size(), 0};
+  for (const auto &station : mStations) {
+    header.month_count += station.months.size();
+  }
+
+  auto temporary_file = state_file;
+  temporary_file += ".tmp";
+
+  std::ofstream file(temporary_file, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open the incremental state file.");
+  }
+
+  const auto write = [&file](const void *data, const size_t size) {
+    file.write(static_cast<const char *>(data), size);
+  };
+
+  write(&header, sizeof(header));
+
+  size_t first_month = 0;
+  for (const auto &station : mStations) {
+    const StationEntry entry{station.id, first_month, station.months.size()};
+    write(&entry, sizeof(entry));
+    first_month += station.months.size();
+  }
+
+  for (const auto &station : mStations) {
+    write(station.months.data(),
+          station.months.size() * sizeof(MonthAggregate));
+  }
+
+  file.close();
+  if (file.fail()) {
+    throw std::runtime_error("Failed to write the incremental state file.");
+  }
+
+  std::filesystem::rename(temporary_file, state_file);
+}
+
+/**
+ * @brief Adds the measurements to the aggregates of their months.
+ */
+void add_measurements(StationAggregates &station,
+                      const Measurements &measurements) {
+  auto &months = station.months;
+
+  for (size_t i = 0; i < measurements.size(); i++) {
+    const auto year = measurements.years[i];
+    const auto month = measurements.months[i];
+    const auto value = measurements.values[i];
+
+    const auto date = [](const MonthAggregate &aggregate) {
+      return std::pair(aggregate.year, aggregate.month);
+    };
+
+    // the rows come in order, so it's almost always the last month or a new
+    // one, a late row for an older month is inserted in place
+    auto aggregate = months.end();
+    if (!months.empty() && date(months.back()) == std::pair(year, month)) {
+      aggregate = months.end() - 1;
+    } else {
+      aggregate = std::ranges::lower_bound(months, std::pair(year, month), {},
+                                           date);
+      if (aggregate == months.end() ||
+          date(*aggregate) != std::pair(year, month)) {
+        aggregate = months.insert(
+            aggregate, {year, month, 0, 0,
+                        std::numeric_limits<Temperature>::infinity(),
+                        -std::numeric_limits<Temperature>::infinity()});
+      }
+    }
+
+    aggregate->count++;
+    aggregate->sum += value;
+    aggregate->min = std::min(aggregate->min, value);
+    aggregate->max = std::max(aggregate->max, value);
+  }
+}
+
+size_t State::update(Stations stations, const std::string_view measurements,
+                     const ParsingOptions &options) {
+  if (stations.size() != mStations.size()) {
+    throw std::runtime_error(
+        "The stations don't match the incremental state.");
+  }
+
+  size_t begin = mOffset;
+  if (begin == 0) {
+    // skip header
+    const size_t newline_index = measurements.find("\r\n"sv);
+    if (newline_index == std::string_view::npos) {
+      return 0;
+    }
+    begin = newline_index + 2;
+  }
+
+  // an incomplete last line is left for the next run
+  const auto appended = measurements.substr(begin);
+  const size_t newline_index = appended.rfind("\r\n"sv);
+  const size_t end = newline_index == std::string_view::npos
+                         ? 0
+                         : newline_index + 2;
+
+  parse_measurement_lines(stations, appended.substr(0, end), options);
+
+  size_t count = 0;
+  for (size_t i = 0; i < stations.size(); i++) {
+    add_measurements(mStations[i], stations[i].measurements);
+    count += stations[i].measurements.size();
+  }
+
+  mOffset = begin + end;
+  return count;
+}
+
+MonthlyStatsTable State::monthly_stats(std::vector<char> &valid) const {
+  std::vector<std::pair<Year, Year>> year_ranges(mStations.size(), {0, -1});
+  for (size_t i = 0; i < mStations.size(); i++) {
+    const auto &months = mStations[i].months;
+    if (!months.empty()) {
+      year_ranges[i] = {months.front().year, months.back().year};
+    }
+  }
+
+  MonthlyStatsTable stats(year_ranges);
+  valid.assign(mStations.size(), false);
+
+  for (size_t i = 0; i < mStations.size(); i++) {
+    const auto &months = mStations[i].months;
+    auto &station_stats = stats[i];
+
+    station_stats.clear();
+
+    if (months.empty()) {
+      continue;
+    }
+
+    size_t count = 0;
+    for (const auto &aggregate : months) {
+      const auto average = aggregate.sum / aggregate.count;
+
+      auto &min_max = station_stats.minmaxes[aggregate.month - 1];
+      min_max.min = std::min(min_max.min, average);
+      min_max.max = std::max(min_max.max, average);
+
+      station_stats.average(aggregate.year, aggregate.month) = average;
+      count += aggregate.count;
+    }
+
+    valid[i] = valid_station(months.front().year, months.back().year, count);
+  }
+
+  return stats;
+}
+
+} // namespace incremental
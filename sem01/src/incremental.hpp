@@ -0,0 +1,110 @@
+#pragma once
+
+#include "data.hpp"
+#include "parsing.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+/**
+ * Incremental processing of a measurements file that only grows by appending
+ * new rows.
+ *
+ * Instead of the measurements, the state keeps running aggregates of each
+ * month of each year of every station, and how much of the file they cover.
+ * The next run then parses only the appended bytes and folds them in, so
+ * a daily refresh costs O(new rows) instead of O(history).
+ *
+ * Layout of the state file (all values in native byte order):
+ *
+ * - header: magic, format version, size and modification time of the
+ *   stations file, the number of bytes of the measurements file processed,
+ *   hashes of the beginning and of the end of the processed part, and the
+ *   number of stations and months
+ * - station table: id, first month and number of months of each station
+ * - months of all stations concatenated, each ordered by date
+ */
+namespace incremental {
+
+/**
+ * @brief Aggregates of the measurements of one month of one year.
+ */
+struct MonthAggregate {
+  Year year;
+  Month month;
+  uint32_t count;
+  Temperature sum;
+  Temperature min;
+  Temperature max;
+};
+
+struct StationAggregates {
+  size_t id;
+  // ordered by date
+  std::vector<MonthAggregate> months;
+};
+
+/**
+ * @class State
+ * @brief Aggregates of all measurements of the file processed so far.
+ */
+class State {
+public:
+  /**
+   * @brief An empty state covering none of the file.
+   */
+  explicit State(const Stations &stations);
+
+  /**
+   * @brief Loads the state from the file.
+   *
+   * @return The state, or `std::nullopt` if the file doesn't exist, is
+   * damaged, has a different version, the stations file changed, or the
+   * processed part of the measurements file is no longer the same (it was
+   * rewritten rather than appended to).
+   */
+  static std::optional<State>
+  load(const std::filesystem::path &state_file,
+       const std::filesystem::path &stations_file,
+       std::string_view measurements);
+
+  /**
+   * @brief Writes the state under a temporary name and renames it.
+   *
+   * @throws std::runtime_error if the file cannot be written.
+   */
+  void save(const std::filesystem::path &state_file,
+            const std::filesystem::path &stations_file,
+            std::string_view measurements) const;
+
+  /**
+   * @brief Parses the complete lines of the measurements appended since the
+   * last update and adds them to the aggregates.
+   *
+   * @param stations The stations without measurements, to parse into.
+   * @param measurements The whole measurements file.
+   *
+   * @return The number of new measurements.
+   */
+  size_t update(Stations stations, std::string_view measurements,
+                const ParsingOptions &options);
+
+  /**
+   * @brief Monthly stats of all stations, and whether they are valid, as
+   * `Stats::monthly_stats` would calculate them from all the measurements.
+   */
+  MonthlyStatsTable monthly_stats(std::vector<char> &valid) const;
+
+  // bytes of the measurements file covered by the aggregates
+  size_t offset() const { return mOffset; }
+
+private:
+  State() = default;
+
+  size_t mOffset = 0;
+  std::vector<StationAggregates> mStations;
+};
+
+} // namespace incremental
@@ -1,8 +1,12 @@
+#include "cache.hpp"
 #include "config.hpp"
 #include "data.hpp"
+#include "incremental.hpp"
+#include "mapped_file.hpp"
 #include "outliers.hpp"
 #include "parsing.hpp"
 #include "preprocessor.hpp"
+#include "profiler.hpp"
 #include "renderer.hpp"
 #include "stats.hpp"
 #include "threadpool.hpp"
@@ -12,36 +16,33 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <ranges>
 #include <stdexcept>
 #include <vector>
 
-inline constexpr bool PERF_TEST = (
-#ifdef PERF_TEST_MACRO
-    true
-#else
-    false
-#endif
-);
-
-constexpr size_t TEST_RUNS = 100;
-
-int main(int argc, char *argv[]) {
-  Config config;
-  try {
-    config = Config(argc, argv);
-  } catch (std::invalid_argument &e) {
-    std::cerr << e.what() << std::endl;
-    return 1;
-  }
-
-  std::cout << std::format("{}\n", config);
+size_t count_measurements(const Stations &stations) {
+  return std::ranges::fold_left(
+      stations | std::views::transform([](const auto &station) {
+        return station.measurements.size();
+      }),
+      0uz, std::plus<>{});
+}
 
+/**
+ * @brief Loads and parses the input files.
+ */
+Stations load_stations(const Config &config) {
   auto start = std::chrono::high_resolution_clock::now();
 
-  std::string stations_file = read_file(config.stations_file());
-  std::string measurements_file = read_file(config.measurements_file());
+  const MappedFile stations_file(config.stations_file(), config.huge_pages());
+
+  // when streaming, the measurements are read block by block while parsing
+  std::optional<MappedFile> measurements_file;
+  if (!config.stream()) {
+    measurements_file.emplace(config.measurements_file(), config.huge_pages());
+  }
 
   auto elapsed = std::chrono::high_resolution_clock::now() - start;
 
@@ -53,141 +54,237 @@ int main(int argc, char *argv[]) {
 
   auto stations = parse_stations(stations_file);
 
-  fill_measurements(stations, measurements_file, config.mode() == Parallel);
-
-  const auto measurements = std::ranges::fold_left(
-      stations | std::views::transform([](const auto &station) {
-        return station.measurements.size();
-      }),
-      0, std::plus<>{});
+  if (config.stream()) {
+    stream_measurements(stations, config.measurements_file(),
+                        config.parsing_options());
+  } else {
+    fill_measurements(stations, *measurements_file, config.parsing_options());
+  }
 
   elapsed = std::chrono::high_resolution_clock::now() - start;
 
   std::cout << std::format(
       "Loaded data for {} stations and {} measurements in {} ms. "
       "Processing...\n",
-      stations.size(), measurements,
+      stations.size(), count_measurements(stations),
       std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
 
-  const auto processing_start = std::chrono::high_resolution_clock::now();
-
-  const auto preprocessor =
-      choose_by_mode<Preprocessor, SerialPreprocessor, ParallelPreprocessor>(
-          config.mode());
+  return stations;
+}
 
-  Stations stations_copy;
-  if constexpr (PERF_TEST) {
-    stations_copy = stations;
+/**
+ * @brief Loads the stations from the cache if it's up to date, or parses the
+ * input files (and updates the cache).
+ */
+Stations read_stations(const Config &config) {
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  std::optional<Stations> cached_stations;
+  if (config.cache_file()) {
+    cached_stations =
+        cache::load(*config.cache_file(), config.stations_file(),
+                    config.measurements_file());
   }
 
-  preprocessor->preprocess_data(stations);
-  stations.shrink_to_fit();
+  if (!cached_stations) {
+    auto stations = load_stations(config);
+
+    // only an optimization, the run goes on without it
+    if (config.cache_file()) {
+      try {
+        cache::save(*config.cache_file(), config.stations_file(),
+                    config.measurements_file(), stations);
+      } catch (const std::runtime_error &e) {
+        std::cerr << std::format("Failed to save the cache: {}\n", e.what());
+      }
+    }
 
-  if constexpr (PERF_TEST) {
-    size_t total = 0;
-    for (size_t i = 0; i < TEST_RUNS; i++) {
-      auto stations_test = stations_copy;
-      const auto start = std::chrono::high_resolution_clock::now();
+    return stations;
+  }
 
-      preprocessor->preprocess_data(stations_test);
-      stations_test.shrink_to_fit();
+  const auto elapsed = std::chrono::high_resolution_clock::now() - start;
 
-      total += std::chrono::duration_cast<std::chrono::microseconds>(
-                   (std::chrono::high_resolution_clock::now() - start))
-                   .count();
-    }
+  std::cout << std::format(
+      "Loaded data for {} stations and {} measurements from cache in {} ms. "
+      "Processing...\n",
+      cached_stations->size(), count_measurements(*cached_stations),
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
 
-    std::cout << std::format("Preprocessed {} stations in {} μs\n",
-                             stations.size(), total / TEST_RUNS);
+  return std::move(*cached_stations);
+}
+
+/**
+ * @brief Folds the measurements appended since the last run into the
+ * incremental state, starting over if there is no usable one.
+ *
+ * @param stations Filled with the stations, without measurements.
+ */
+incremental::State update_incremental(const Config &config,
+                                      Stations &stations) {
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  const MappedFile stations_file(config.stations_file(), config.huge_pages());
+  const MappedFile measurements_file(config.measurements_file(),
+                                     config.huge_pages());
+
+  stations = parse_stations(stations_file);
+
+  auto state = incremental::State::load(
+      *config.incremental_file(), config.stations_file(), measurements_file);
+  if (!state) {
+    std::cout << "No usable incremental state, processing the whole file.\n";
+    state.emplace(stations);
   }
 
-  const auto stats_calculator =
-      choose_by_mode<Stats, SerialStats, ParallelStats>(config.mode());
+  const size_t previous_offset = state->offset();
+  const size_t count =
+      state->update(stations, measurements_file, config.parsing_options());
 
-  const auto stats = stats_calculator->monthly_stats(stations);
+  // the results of this run don't depend on it, the next one just reads the
+  // new measurements again
+  try {
+    state->save(*config.incremental_file(), config.stations_file(),
+                measurements_file);
+  } catch (const std::runtime_error &e) {
+    std::cerr << std::format("Failed to save the incremental state: {}\n",
+                             e.what());
+  }
 
-  if constexpr (PERF_TEST) {
-    size_t total = 0;
-    for (size_t i = 0; i < TEST_RUNS; i++) {
-      const auto start = std::chrono::high_resolution_clock::now();
+  const auto elapsed = std::chrono::high_resolution_clock::now() - start;
 
-      const auto stats_test = stats_calculator->monthly_stats(stations);
+  std::cout << std::format(
+      "Added {} measurements ({} new bytes) to the incremental state in {} ms. "
+      "Processing...\n",
+      count, state->offset() - previous_offset,
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
 
-      total += std::chrono::duration_cast<std::chrono::microseconds>(
-                   (std::chrono::high_resolution_clock::now() - start))
-                   .count();
-    }
+  return std::move(*state);
+}
 
-    std::cout << std::format("Calculated stats for {} stations in {} μs\n",
-                             stations.size(), total / TEST_RUNS);
+/**
+ * @brief Creates the renderer of the format of the maps, serial or parallel
+ * by the mode.
+ */
+std::unique_ptr<Renderer> create_renderer(const Config &config) {
+  const size_t threads = config.phase_threads(Phase::Rendering);
+  switch (config.renderer()) {
+  case RendererKind::Bitmap:
+    return choose_by_mode<Renderer, SerialRasterRenderer,
+                          ParallelRasterRenderer>(config.mode(), threads);
+  case RendererKind::Heatmap:
+    return choose_by_mode<Renderer, SerialHeatmapRenderer,
+                          ParallelHeatmapRenderer>(config.mode(), threads);
+  case RendererKind::Svg:
+    break;
   }
+  return choose_by_mode<Renderer, SerialRenderer, ParallelRenderer>(
+      config.mode(), threads);
+}
 
-  const auto detector = std::make_unique<SerialOutlierDetector>();
+int main(int argc, char *argv[]) {
+  Config config;
+  try {
+    config = Config(argc, argv);
+  } catch (std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
 
-  const auto stats_ptr =
-      std::make_shared<std::vector<StationMonthlyStats>>(stats);
+  if (config.mode() == ProcessingMode::Parallel) {
+    try {
+      if (config.threads() != 0) {
+        threadpool::pool.resize(config.threads() - 1);
+      }
+      if (config.pin() != topology::AffinityPolicy::None) {
+        threadpool::pool.pin(config.pin());
+      }
+    } catch (std::runtime_error &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
 
-  if (config.mode() == ProcessingMode::Serial) {
-    std::ofstream outlier_file("output/vykyvy.csv");
-    outlier_file << OUTLIER_FILE_HEADER << std::endl;
-    detector->find_outliers(stations, stats, outlier_file);
-  } else {
-    threadpool::pool.spawn([&stations, stats_ptr, &detector] {
-      std::ofstream outlier_file("output/vykyvy.csv");
-      outlier_file << OUTLIER_FILE_HEADER << std::endl;
-      detector->find_outliers(stations, *stats_ptr, outlier_file);
-    });
-  }
-
-  if constexpr (PERF_TEST) {
-    size_t total = 0;
-    size_t outlier_count = 0;
-    for (size_t i = 0; i < TEST_RUNS; i++) {
-      const auto start = std::chrono::high_resolution_clock::now();
-
-      std::ofstream outlier_file("output/vykyvy.csv");
-      outlier_file << OUTLIER_FILE_HEADER << std::endl;
-      outlier_count =
-          detector->find_outliers(stations, *stats_ptr, outlier_file);
-
-      total += std::chrono::duration_cast<std::chrono::microseconds>(
-                   (std::chrono::high_resolution_clock::now() - start))
-                   .count();
+  std::cout << std::format("{}\n", config);
+
+  // after resizing the pool, so the counters cover all of its workers
+  profiling::Profiler profiler(config.counters(),
+                               config.trace_file().has_value());
+
+  Stations stations;
+  std::optional<incremental::State> state;
+  {
+    const auto phase = profiler.phase("parse");
+    if (config.incremental_file()) {
+      state = update_incremental(config, stations);
+    } else {
+      stations = read_stations(config);
     }
+  }
+
+  const auto processing_start = std::chrono::high_resolution_clock::now();
 
-    std::cout << std::format("Detected {} outliers in {} μs\n", outlier_count,
-                             total / TEST_RUNS);
+  const auto stats_calculator =
+      choose_by_mode<Stats, SerialStats, ParallelStats>(
+          config.mode(), config.phase_threads(Phase::Stats));
+
+  // calculated for all stations, validating them in the same pass
+  std::vector<char> valid;
+  MonthlyStatsTable stats;
+  {
+    const auto phase = profiler.phase("stats");
+    stats = state ? state->monthly_stats(valid)
+                  : stats_calculator->monthly_stats(stations, valid);
   }
 
-  const auto renderer =
-      choose_by_mode<Renderer, SerialRenderer, ParallelRenderer>(config.mode());
+  const auto preprocessor =
+      choose_by_mode<Preprocessor, SerialPreprocessor, ParallelPreprocessor>(
+          config.mode(), config.phase_threads(Phase::Preprocessing));
 
-  renderer->render_months(stations, *stats_ptr);
+  {
+    const auto phase = profiler.phase("preprocess");
+    preprocessor->preprocess_data(stations, stats, valid);
+    stations.shrink_to_fit();
+  }
 
-  if constexpr (PERF_TEST) {
-    size_t total = 0;
-    for (size_t i = 0; i < TEST_RUNS; i++) {
-      auto start = std::chrono::high_resolution_clock::now();
+  const auto detector =
+      choose_by_mode<OutlierDetector, SerialOutlierDetector,
+                     ParallelOutlierDetector>(
+          config.mode(), config.phase_threads(Phase::Outliers));
+  detector->set_rule(make_rule(config.detector()));
 
-      renderer->render_months(stations, *stats_ptr);
+  {
+    const auto phase = profiler.phase("outliers");
+    std::ofstream outlier_file("output/vykyvy.csv");
+    outlier_file << detector->rule().header() << '\n';
+    detector->find_outliers(stations, stats, outlier_file);
+  }
 
-      total += std::chrono::duration_cast<std::chrono::microseconds>(
-                   (std::chrono::high_resolution_clock::now() - start))
-                   .count();
-    }
+  const auto renderer = create_renderer(config);
 
-    std::cout << std::format("Rendered SVG files in {} μs\n",
-                             total / TEST_RUNS);
+  {
+    const auto phase = profiler.phase("render");
+    renderer->render_months(stations, stats);
   }
 
   threadpool::pool.join();
 
-  if constexpr (!PERF_TEST) {
-    const auto elapsed =
-        std::chrono::high_resolution_clock::now() - processing_start;
-    std::cout << std::format(
-        "Processed data in {} μs\n",
-        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  const auto elapsed =
+      std::chrono::high_resolution_clock::now() - processing_start;
+  std::cout << std::format(
+      "Processed data in {} μs\n",
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+  if (config.counters()) {
+    profiler.print_table(std::cout);
+  }
+
+  if (config.trace_file()) {
+    try {
+      profiler.write_trace(*config.trace_file());
+    } catch (std::runtime_error &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
   }
 
   return 0;
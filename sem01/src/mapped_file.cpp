@@ -0,0 +1,70 @@
+#include "mapped_file.hpp"
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+MappedFile::MappedFile(const std::filesystem::path &path, bool huge_pages) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open file.");
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0) {
+    close(fd);
+    throw std::runtime_error("Failed to stat file.");
+  }
+
+  mSize = static_cast<size_t>(file_stat.st_size);
+
+  // mmap doesn't accept empty mappings, leave the view empty instead
+  if (mSize == 0) {
+    close(fd);
+    return;
+  }
+
+  void *data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    mSize = 0;
+    throw std::runtime_error("Failed to map file.");
+  }
+
+  mData = data;
+
+  // These are only hints, so the errors are ignored. WILLNEED starts an
+  // asynchronous readahead, so the parser can begin before the whole file
+  // is resident.
+  madvise(mData, mSize, MADV_SEQUENTIAL);
+  madvise(mData, mSize, MADV_WILLNEED);
+
+  if (huge_pages) {
+    madvise(mData, mSize, MADV_HUGEPAGE);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (mData != nullptr) {
+    munmap(mData, mSize);
+  }
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : mData(std::exchange(other.mData, nullptr)),
+      mSize(std::exchange(other.mSize, 0)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    if (mData != nullptr) {
+      munmap(mData, mSize);
+    }
+    mData = std::exchange(other.mData, nullptr);
+    mSize = std::exchange(other.mSize, 0);
+  }
+  return *this;
+}
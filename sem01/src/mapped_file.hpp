@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+/**
+ * @class MappedFile
+ * @brief A read-only memory mapping of a whole input file.
+ *
+ * Exposes the contents of the file as a `std::string_view` without copying
+ * them into a separate buffer. The kernel is hinted that the mapping will be
+ * read sequentially, so the pages are read ahead in the background while the
+ * parser already works on the beginning of the file.
+ */
+class MappedFile {
+public:
+  /**
+   * @brief Map the file into memory.
+   *
+   * @param path Path to the file to map.
+   * @param huge_pages Whether to ask the kernel to back the mapping with
+   * transparent huge pages. Only a hint, silently ignored when unsupported.
+   *
+   * @throws std::runtime_error if the file cannot be opened or mapped.
+   */
+  explicit MappedFile(const std::filesystem::path &path,
+                      bool huge_pages = false);
+
+  /**
+   * @brief Unmap the file.
+   */
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+
+  std::string_view view() const {
+    return {static_cast<const char *>(mData), mSize};
+  }
+  operator std::string_view() const { return view(); }
+
+  size_t size() const { return mSize; }
+
+private:
+  void *mData = nullptr;
+  size_t mSize = 0;
+};
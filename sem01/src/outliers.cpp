@@ -1,73 +1,411 @@
 #include "outliers.hpp"
 #include "threadpool.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <format>
 #include <ostream>
 #include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-std::string format_outlier(const Outlier &outlier) {
-  return std::format("{};{};{};{}\n", outlier.station_id, outlier.month,
-                     outlier.year, outlier.difference);
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Appends the row of the outlier to the buffer.
+ *
+ * `std::to_chars` writes the same shortest representation of the numbers as
+ * `std::format`, without parsing a format string or a temporary string.
+ */
+void format_outlier(std::string &buffer, const Outlier &outlier) {
+  // the numbers take at most 20, 6, 6, 6 and 24 characters, plus 5
+  // separators
+  constexpr size_t MAX_ROW_SIZE = 80;
+
+  const size_t size = buffer.size();
+  buffer.resize_and_overwrite(
+      size + MAX_ROW_SIZE, [&](char *data, const size_t new_size) {
+        char *out = data + size;
+        char *const end = data + new_size;
+
+        out = std::to_chars(out, end, outlier.station_id).ptr;
+        *out++ = ';';
+        out = std::to_chars(out, end, outlier.month).ptr;
+        *out++ = ';';
+        out = std::to_chars(out, end, outlier.year).ptr;
+        *out++ = ';';
+        if (outlier.day != 0) {
+          out = std::to_chars(out, end, outlier.day).ptr;
+          *out++ = ';';
+        }
+        out = std::to_chars(out, end, outlier.difference).ptr;
+        *out++ = '\n';
+
+        return out - data;
+      });
 }
 
-void output_outliers(const Station &station, const StationMonthlyStats &stats,
-                     const std::function<void(const Outlier &)> &save_outlier) {
-  for (const auto [i, item] :
-       std::views::zip(stats.first, stats.second) | std::views::enumerate) {
-    const auto [month, min_max] = item;
+size_t JumpRule::station_outliers(const Station &station,
+                                  const StationMonthlyStats &stats,
+                                  std::string &buffer) const {
+  size_t count = 0;
 
+  for (const auto [i, min_max] : stats.minmaxes | std::views::enumerate) {
     const auto allowed_difference = 0.75f * (min_max.max - min_max.min);
+    const auto averages = stats.month_averages(i);
+
+    for (size_t year = 1; year < averages.size(); year++) {
+      // NaN if either month has no measurements, which is never greater
+      const auto diff = std::abs(averages[year] - averages[year - 1]);
+
+      if (diff > allowed_difference) {
+        format_outlier(buffer, {station.id, static_cast<Month>(i + 1),
+                                static_cast<Year>(stats.first_year + year),
+                                diff});
+        count++;
+      }
+    }
+  }
+
+  return count;
+}
+
+Temperature sorted_median(const std::span<const Temperature> sorted) {
+  const size_t middle = sorted.size() / 2;
+  return sorted.size() % 2 == 1 ? sorted[middle]
+                                : (sorted[middle - 1] + sorted[middle]) / 2;
+}
+
+/**
+ * @brief Median of the absolute deviations of the sorted values from their
+ * median.
+ *
+ * Going outwards from the median, the deviations of the values on both sides
+ * are each ascending, so merging them sorts all of them without a sort.
+ */
+Temperature median_deviation(const std::span<const Temperature> sorted,
+                             const Temperature median) {
+  std::array<Temperature, RollingMadRule::WINDOW> deviations;
+
+  size_t right = std::ranges::lower_bound(sorted, median) - sorted.begin();
+  size_t left = right;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    if (right == sorted.size() ||
+        (left > 0 && median - sorted[left - 1] <= sorted[right] - median)) {
+      deviations[i] = median - sorted[--left];
+    } else {
+      deviations[i] = sorted[right++] - median;
+    }
+  }
+
+  return sorted_median({deviations.data(), sorted.size()});
+}
+
+size_t RollingMadRule::station_outliers(const Station &station,
+                                        const StationMonthlyStats &stats,
+                                        std::string &buffer) const {
+  // scales the MAD to the standard deviation of normally distributed values
+  constexpr Temperature MAD_SCALE = 1.4826;
+
+  size_t count = 0;
 
-    for (const auto [prev, next] : std::views::pairwise(month)) {
-      if (next.first != prev.first + 1) {
+  for (size_t month = 0; month < stats.minmaxes.size(); month++) {
+    const auto averages = stats.month_averages(month);
+
+    // the averages of the previous years of the window, sorted
+    std::array<Temperature, WINDOW> window;
+    size_t size = 0;
+
+    for (size_t year = 0; year < averages.size(); year++) {
+      const auto average = averages[year];
+      const bool present = !std::isnan(average);
+
+      if (present && size >= MIN_YEARS) {
+        const std::span<const Temperature> sorted(window.data(), size);
+        const auto median = sorted_median(sorted);
+        const auto deviation = std::abs(average - median);
+
+        if (deviation >
+            THRESHOLD * MAD_SCALE * median_deviation(sorted, median)) {
+          format_outlier(buffer, {station.id, static_cast<Month>(month + 1),
+                                  static_cast<Year>(stats.first_year + year),
+                                  deviation});
+          count++;
+        }
+      }
+
+      // slide the window by a year
+      if (year >= WINDOW && !std::isnan(averages[year - WINDOW])) {
+        const auto leaving = std::ranges::lower_bound(
+            window.begin(), window.begin() + size, averages[year - WINDOW]);
+        std::shift_left(leaving, window.begin() + size, 1);
+        size--;
+      }
+      if (present) {
+        const auto position = std::ranges::upper_bound(
+            window.begin(), window.begin() + size, average);
+        std::shift_right(position, window.begin() + size + 1, 1);
+        *position = average;
+        size++;
+      }
+    }
+  }
+
+  return count;
+}
+
+size_t SeasonalZScoreRule::station_outliers(const Station &station,
+                                            const StationMonthlyStats &stats,
+                                            std::string &buffer) const {
+  size_t count = 0;
+
+  for (size_t month = 0; month < stats.minmaxes.size(); month++) {
+    size_t years = 0;
+    Temperature mean = 0;
+    // sum of the squared differences from the mean
+    Temperature squares = 0;
+
+    for (const auto [year, average] :
+         stats.month_averages(month) | std::views::enumerate) {
+      if (std::isnan(average)) {
         continue;
       }
 
-      const auto diff = std::abs(next.second - prev.second);
+      if (years >= MIN_YEARS) {
+        const auto deviation = std::abs(average - mean);
+        const auto standard_deviation = std::sqrt(squares / (years - 1));
 
-      if (diff > allowed_difference) {
-        save_outlier({station.id, static_cast<Month>(i + 1), next.first, diff});
+        if (deviation > THRESHOLD * standard_deviation) {
+          format_outlier(buffer, {station.id, static_cast<Month>(month + 1),
+                                  static_cast<Year>(stats.first_year + year),
+                                  deviation});
+          count++;
+        }
       }
+
+      years++;
+      const auto delta = average - mean;
+      mean += delta / years;
+      squares += delta * (average - mean);
+    }
+  }
+
+  return count;
+}
+
+/**
+ * @brief How far the value sticks out of both of its neighbours in the same
+ * direction, negative or 0 if it doesn't.
+ *
+ * Only minimums and maximums, without branches, which would be mispredicted
+ * on noisy values.
+ */
+inline Temperature spike_height(const Temperature previous,
+                                const Temperature value,
+                                const Temperature next) {
+  const auto rise = value - previous;
+  const auto fall = value - next;
+  return std::max(std::min(rise, fall), -std::max(rise, fall));
+}
+
+/**
+ * @brief Index of the first spike from `from` on, or `end` if there isn't
+ * any. The values at `from - 1` and `end` have to exist.
+ */
+size_t next_spike_scalar(const Temperature *values, size_t from,
+                         const size_t end) {
+  for (; from < end; from++) {
+    if (spike_height(values[from - 1], values[from], values[from + 1]) >
+        SpikeRule::THRESHOLD) {
+      return from;
     }
   }
+  return end;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) size_t
+next_spike_avx2(const Temperature *values, size_t from, const size_t end) {
+  const __m256d threshold = _mm256_set1_pd(SpikeRule::THRESHOLD);
+  const __m256d zero = _mm256_setzero_pd();
+
+  for (; from + 4 <= end; from += 4) {
+    const __m256d value = _mm256_loadu_pd(values + from);
+    const __m256d rise =
+        _mm256_sub_pd(value, _mm256_loadu_pd(values + from - 1));
+    const __m256d fall =
+        _mm256_sub_pd(value, _mm256_loadu_pd(values + from + 1));
+    const __m256d height = _mm256_max_pd(
+        _mm256_min_pd(rise, fall),
+        _mm256_sub_pd(zero, _mm256_max_pd(rise, fall)));
+
+    const auto spikes = static_cast<unsigned>(_mm256_movemask_pd(
+        _mm256_cmp_pd(height, threshold, _CMP_GT_OQ)));
+    if (spikes != 0) {
+      return from + std::countr_zero(spikes);
+    }
+  }
+
+  return next_spike_scalar(values, from, end);
 }
 
-size_t SerialOutlierDetector::find_outliers(
-    const Stations &stations, const std::vector<StationMonthlyStats> &stats,
-    std::ostream &outliers) const {
+#endif
+
+using NextSpike = size_t (*)(const Temperature *values, size_t from,
+                             size_t end);
+
+NextSpike next_spike_kernel() {
+  static const NextSpike kernel = [] {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+      return next_spike_avx2;
+    }
+#endif
+    return next_spike_scalar;
+  }();
+  return kernel;
+}
+
+size_t SpikeRule::station_outliers(const Station &station,
+                                   const StationMonthlyStats &,
+                                   std::string &buffer) const {
+  const auto &measurements = station.measurements;
+  if (measurements.size() < 3) {
+    return 0;
+  }
+
+  // spikes are rare, so the kernel skips over the values between them
+  const auto next_spike = next_spike_kernel();
+  const Temperature *values = measurements.values.data();
+  const size_t end = measurements.size() - 1;
+
+  size_t count = 0;
+  for (size_t i = next_spike(values, 1, end); i < end;
+       i = next_spike(values, i + 1, end)) {
+    format_outlier(buffer,
+                   {station.id, measurements.months[i], measurements.years[i],
+                    spike_height(values[i - 1], values[i], values[i + 1]),
+                    measurements.days[i]});
+    count++;
+  }
+
+  return count;
+}
 
+OutlierRuleKind parse_rule(const std::string_view name) {
+  if (name == "jump") {
+    return OutlierRuleKind::Jump;
+  } else if (name == "mad") {
+    return OutlierRuleKind::RollingMad;
+  } else if (name == "zscore") {
+    return OutlierRuleKind::SeasonalZScore;
+  } else if (name == "spike") {
+    return OutlierRuleKind::Spike;
+  }
+  throw std::invalid_argument(
+      std::format("Unknown outlier detector '{}', expected one of jump, mad, "
+                  "zscore, spike.",
+                  name));
+}
+
+std::string_view rule_name(const OutlierRuleKind kind) {
+  switch (kind) {
+  case OutlierRuleKind::Jump:
+    return "jump";
+  case OutlierRuleKind::RollingMad:
+    return "mad";
+  case OutlierRuleKind::SeasonalZScore:
+    return "zscore";
+  case OutlierRuleKind::Spike:
+    return "spike";
+  }
+  return "unknown";
+}
+
+std::unique_ptr<const OutlierRule> make_rule(const OutlierRuleKind kind) {
+  switch (kind) {
+  case OutlierRuleKind::RollingMad:
+    return std::make_unique<RollingMadRule>();
+  case OutlierRuleKind::SeasonalZScore:
+    return std::make_unique<SeasonalZScoreRule>();
+  case OutlierRuleKind::Spike:
+    return std::make_unique<SpikeRule>();
+  case OutlierRuleKind::Jump:
+    break;
+  }
+  return std::make_unique<JumpRule>();
+}
+
+size_t SerialOutlierDetector::find_outliers(const Stations &stations,
+                                            const MonthlyStatsTable &stats,
+                                            std::ostream &outliers) const {
+  std::string buffer;
   size_t outliers_count = 0;
-  const auto save_outlier = [&outliers, &outliers_count](const auto &outlier) {
-    outliers_count++;
-    outliers << format_outlier(outlier);
-  };
 
   for (const auto &[station, station_stats] :
        std::views::zip(stations, stats)) {
-    output_outliers(station, station_stats, save_outlier);
+    outliers_count += mRule->station_outliers(station, station_stats, buffer);
   }
 
+  outliers.write(buffer.data(), buffer.size());
+
   return outliers_count;
 }
 
-size_t ParallelOutlierDetector::find_outliers(
-    const Stations &stations, const std::vector<StationMonthlyStats> &stats,
-    std::ostream &outliers) const {
+size_t ParallelOutlierDetector::find_outliers(const Stations &stations,
+                                              const MonthlyStatsTable &stats,
+                                              std::ostream &outliers) const {
+  // several blocks per thread, so a block with more outliers than the others
+  // doesn't hold up the rest
+  constexpr size_t BLOCKS_PER_THREAD = 4;
 
-  size_t outliers_count = 0;
-  std::mutex mutex;
-  const auto save_outlier = [&mutex, &outliers,
-                             &outliers_count](const auto &outlier) mutable {
-    const auto formatted = format_outlier(outlier);
-    std::lock_guard lock{mutex};
-    outliers_count++;
-    outliers << formatted;
-  };
-
-  const auto process_station = [&save_outlier](const auto &item) {
-    const auto [station, station_stats] = item;
-    output_outliers(station, station_stats, save_outlier);
-  };
-
-  threadpool::pool.for_each(std::views::zip(stations, stats), process_station);
+  if (stations.empty()) {
+    return 0;
+  }
 
-  return outliers_count;
+  const size_t threads = mThreads != 0
+                             ? std::min(mThreads, threadpool::pool.size() + 1)
+                             : threadpool::pool.size() + 1;
+  const size_t block_count =
+      std::min(stations.size(), threads * BLOCKS_PER_THREAD);
+
+  std::vector<std::string> buffers(block_count);
+  std::vector<size_t> counts(block_count);
+
+  threadpool::pool.parallel_for(
+      block_count,
+      [&](const size_t block) {
+        const size_t begin = block * stations.size() / block_count;
+        const size_t end = (block + 1) * stations.size() / block_count;
+
+        for (size_t i = begin; i < end; i++) {
+          counts[block] +=
+              mRule->station_outliers(stations[i], stats[i], buffers[block]);
+        }
+      },
+      {.schedule = threadpool::Schedule::Dynamic,
+       .grain = 1,
+       .max_threads = mThreads});
+
+  // concatenated into the first buffer for a single write
+  std::string &output = buffers.front();
+  size_t size = 0;
+  for (const auto &buffer : buffers) {
+    size += buffer.size();
+  }
+  output.reserve(size);
+  for (size_t i = 1; i < buffers.size(); i++) {
+    output += buffers[i];
+  }
+
+  outliers.write(output.data(), output.size());
+
+  return std::ranges::fold_left(counts, 0uz, std::plus{});
 }
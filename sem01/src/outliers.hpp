@@ -1,28 +1,166 @@
 #pragma once
 
 #include "data.hpp"
+#include <format>
+#include <memory>
+#include <string>
+#include <string_view>
 
 constexpr std::string_view OUTLIER_FILE_HEADER = "id;mesic;rok;rozdil";
+constexpr std::string_view DAY_OUTLIER_FILE_HEADER = "id;mesic;rok;den;rozdil";
+
+/**
+ * @brief Rule deciding which months (or days) of a station are outliers.
+ *
+ * Each rule is a single pass over either the monthly stats or the raw
+ * measurements of one station, so the detectors can run it on any number of
+ * stations at once.
+ */
+class OutlierRule {
+public:
+  virtual ~OutlierRule() = default;
+
+  // header of the output file, naming the columns of the rows
+  virtual std::string_view header() const { return OUTLIER_FILE_HEADER; }
+
+  /**
+   * @brief Appends the rows of the outliers of the station to the buffer.
+   *
+   * @return The number of outliers.
+   */
+  virtual size_t station_outliers(const Station &station,
+                                  const StationMonthlyStats &stats,
+                                  std::string &buffer) const = 0;
+};
+
+/**
+ * A month whose average differs from the one of the previous year by more
+ * than 3/4 of the range of the averages of the month.
+ */
+class JumpRule : public OutlierRule {
+public:
+  size_t station_outliers(const Station &station,
+                          const StationMonthlyStats &stats,
+                          std::string &buffer) const override;
+};
+
+/**
+ * A month whose average is further from the median of the same month of the
+ * previous `WINDOW` years than `THRESHOLD` times their scaled median absolute
+ * deviation. The window is kept sorted as it slides, so both medians are a
+ * merge of at most `WINDOW` values per year.
+ */
+class RollingMadRule : public OutlierRule {
+public:
+  static constexpr size_t WINDOW = 10;
+  // fewer years with measurements in the window aren't judged
+  static constexpr size_t MIN_YEARS = 5;
+  static constexpr Temperature THRESHOLD = 3.5;
+
+  size_t station_outliers(const Station &station,
+                          const StationMonthlyStats &stats,
+                          std::string &buffer) const override;
+};
+
+/**
+ * A month whose average is more than `THRESHOLD` standard deviations from the
+ * mean of the same month of all previous years. The mean and the variance
+ * are updated as the years go (Welford's algorithm), so it's a single pass.
+ */
+class SeasonalZScoreRule : public OutlierRule {
+public:
+  // fewer previous years with measurements aren't judged
+  static constexpr size_t MIN_YEARS = 5;
+  static constexpr Temperature THRESHOLD = 3;
+
+  size_t station_outliers(const Station &station,
+                          const StationMonthlyStats &stats,
+                          std::string &buffer) const override;
+};
+
+/**
+ * A single measurement sticking out of both of its neighbours in the same
+ * direction by more than `THRESHOLD` degrees. Goes over the raw values
+ * instead of the monthly stats, so the rows include the day. Touches every
+ * measurement, so the values are scanned with AVX2 when the CPU has it.
+ */
+class SpikeRule : public OutlierRule {
+public:
+  static constexpr Temperature THRESHOLD = 10;
+
+  std::string_view header() const override { return DAY_OUTLIER_FILE_HEADER; }
+
+  size_t station_outliers(const Station &station,
+                          const StationMonthlyStats &stats,
+                          std::string &buffer) const override;
+};
+
+enum class OutlierRuleKind { Jump, RollingMad, SeasonalZScore, Spike };
+
+/**
+ * @brief Parses a rule name: `jump`, `mad`, `zscore` or `spike`.
+ *
+ * @throws std::invalid_argument if the name is unknown.
+ */
+OutlierRuleKind parse_rule(std::string_view name);
+
+std::string_view rule_name(OutlierRuleKind kind);
+
+std::unique_ptr<const OutlierRule> make_rule(OutlierRuleKind kind);
 
 class OutlierDetector {
 public:
+  OutlierDetector() : mRule(std::make_unique<JumpRule>()) {}
   virtual ~OutlierDetector() = default;
 
+  void set_rule(std::unique_ptr<const OutlierRule> rule) {
+    mRule = std::move(rule);
+  }
+  const OutlierRule &rule() const { return *mRule; }
+
+  /**
+   * @brief Writes the outliers of all stations, in the order of the stations,
+   * with a single write.
+   *
+   * @return The number of outliers.
+   */
   virtual size_t find_outliers(const Stations &stations,
-                               const std::vector<StationMonthlyStats> &stats,
+                               const MonthlyStatsTable &stats,
                                std::ostream &outliers) const = 0;
+
+protected:
+  std::unique_ptr<const OutlierRule> mRule;
 };
 
 class SerialOutlierDetector : public OutlierDetector {
 public:
-  size_t find_outliers(const Stations &stations,
-                       const std::vector<StationMonthlyStats> &stats,
+  size_t find_outliers(const Stations &stations, const MonthlyStatsTable &stats,
                        std::ostream &outliers) const override;
 };
 
+/**
+ * Splits the stations into contiguous blocks, each formatted into its own
+ * buffer by whichever thread takes it. The buffers are then concatenated in
+ * the order of the blocks, so the output is the same as the serial one.
+ */
 class ParallelOutlierDetector : public OutlierDetector {
 public:
-  size_t find_outliers(const Stations &stations,
-                       const std::vector<StationMonthlyStats> &stats,
+  // threads: maximum number of threads to use, 0 for the whole pool
+  explicit ParallelOutlierDetector(size_t threads = 0) : mThreads(threads) {}
+
+  size_t find_outliers(const Stations &stations, const MonthlyStatsTable &stats,
                        std::ostream &outliers) const override;
+
+private:
+  size_t mThreads;
+};
+
+template <> struct std::formatter<OutlierRuleKind> {
+  constexpr auto parse(std::format_parse_context const &ctx) const {
+    return ctx.begin();
+  }
+  template <typename FormatContext>
+  auto format(const OutlierRuleKind &kind, FormatContext &ctx) const {
+    return std::format_to(ctx.out(), "{}", rule_name(kind));
+  }
 };
@@ -1,203 +1,326 @@
 #include "parsing.hpp"
+#include "scanner.hpp"
 #include "threadpool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <fstream>
 #include <iostream>
-#include <mutex>
+#include <limits>
+#include <memory>
 #include <ranges>
+#include <semaphore>
 
 using std::operator""sv;
 
-/**
- * @brief Converts a string to a number.
- *
- * Simpler and faster version of stoul optimized for raw speed with no error
- * or bounds checking.
- */
-size_t str_to_number(std::string_view &str) {
-  size_t result = 0;
-  const auto *ptr = str.data();
-  const auto *end = str.end();
-  // disable loop unrolling, since the numbers are usually only a few digits
-  // long
-#pragma clang loop unroll(disable)
-  while (ptr < end) [[likely]] {
-    result *= 10;
-    result += *ptr++ - '0';
-
-    if (*ptr == ';') [[unlikely]] {
-      str = {ptr + 1, end};
-      return result;
-    }
-  }
-  return result;
-}
-// for stations
-size_t str_to_number(auto str) {
-  size_t result = 0;
-  // disable loop unrolling, since the numbers are usually only a few digits
-  // long
-#pragma clang loop unroll(disable)
-  for (const char c : str) {
-    result *= 10;
-    result += c - '0';
-  }
-  return result;
-}
+Stations parse_stations(std::string_view file_string) {
+  Stations stations;
 
-/**
- * @brief Converts a string to a double.
- *
- * Simpler and faster version of stod optimized for raw speed with no error
- * or bounds checking.
- */
-double str_to_double(auto str) {
-  const char *ptr = str.data();
-  const char *end = str.end();
+  // the names take up less than the file
+  const arena::Allocator<char> allocator(
+      std::make_shared<arena::Arena>(file_string.size()));
+
+  for (const auto &file_line :
+       std::views::split(file_string, "\r\n"sv) | std::views::drop(1)) {
+    if (file_line.empty()) {
+      continue;
+    }
 
-  bool has_signum = str[0] == '-';
-  ptr += has_signum;
+    auto tokens = std::views::split(file_line, ';');
+    auto iterator = tokens.begin();
 
-  int_fast64_t acc = 0;
+    size_t id = scanner::str_to_number(*iterator++);
+    const auto name_token = *iterator++;
+    arena::String name(name_token.begin(), name_token.end(), allocator);
+    float longitude = scanner::str_to_double(std::string_view(*iterator++));
+    float latitude = scanner::str_to_double(std::string_view(*iterator++));
 
-#pragma clang loop unroll(disable)
-  while (ptr < end && *ptr != '.') {
-    acc *= 10;
-    acc += *ptr - '0';
-    ptr++;
+    stations.emplace_back(id, std::move(name),
+                          std::make_pair(latitude, longitude));
   }
 
-  double whole = has_signum ? -acc : acc;
+  return stations;
+}
+
+void allocate_measurements(Stations &stations,
+                           const std::vector<size_t> &counts) {
+  // each column may need padding to its alignment
+  constexpr size_t PADDING = 5 * alignof(std::max_align_t);
 
-  if (ptr == end) [[unlikely]] {
-    return whole;
+  size_t capacity = 0;
+  for (size_t i = 0; i < stations.size(); i++) {
+    capacity += (stations[i].measurements.size() + counts[i]) *
+                    Measurements::ROW_SIZE +
+                PADDING;
   }
 
-  uint_fast32_t decimals = 0;
-  uint_fast32_t power = 10;
+  const arena::Allocator<std::byte> allocator(
+      std::make_shared<arena::Arena>(capacity));
 
-#pragma clang loop unroll(disable)
-  while (++ptr < end) {
-    decimals *= 10;
-    decimals += *ptr++ - '0';
-    power *= 10;
-  }
+  const auto append = [](const auto &source, auto &destination) {
+    destination.insert(destination.end(), source.begin(), source.end());
+  };
+
+  for (size_t i = 0; i < stations.size(); i++) {
+    auto &measurements = stations[i].measurements;
+
+    Measurements allocated(allocator);
+    allocated.reserve(measurements.size() + counts[i]);
 
-  double fractional = static_cast<double>(decimals) / power;
-  double result = whole + (has_signum ? -fractional : fractional);
+    append(measurements.ordinals, allocated.ordinals);
+    append(measurements.years, allocated.years);
+    append(measurements.months, allocated.months);
+    append(measurements.days, allocated.days);
+    append(measurements.values, allocated.values);
 
-  return result;
+    measurements = std::move(allocated);
+  }
 }
 
-Stations parse_stations(const std::string &file_string) {
-  Stations stations;
+/**
+ * @brief Counts the measurements of each station, for allocating them.
+ *
+ * The file is sorted by station, so instead of going line by line, the end
+ * of the run of each station is found by a galloping search over the ids at
+ * the starts of the lines, and only the newlines of the run are counted, with
+ * SIMD. Exact for a sorted file, otherwise only
+ * an estimate, and the columns grow as needed while parsing.
+ */
+std::vector<size_t> count_measurements(const Stations &stations,
+                                       const std::string_view content) {
+  std::vector<size_t> counts(stations.size());
+
+  // start of the first line at or after the offset
+  const auto line_start = [&content](const size_t offset) {
+    if (offset == 0) {
+      return 0uz;
+    }
+    const size_t newline_index = content.find('\n', offset - 1);
+    return newline_index == std::string_view::npos ? content.size()
+                                                   : newline_index + 1;
+  };
 
-  for (const auto &file_line :
-       std::views::split(file_string, "\r\n"sv) | std::views::drop(1)) {
-    if (file_line.empty()) {
-      continue;
+  const auto id_at = [&content](size_t offset) {
+    size_t id = 0;
+    for (; offset < content.size() && content[offset] >= '0' &&
+           content[offset] <= '9';
+         offset++) {
+      id = id * 10 + (content[offset] - '0');
     }
+    return id;
+  };
 
-    auto tokens = std::views::split(file_line, ';');
-    auto iterator = tokens.begin();
+  size_t begin = 0;
+  while (begin < content.size()) {
+    const size_t id = id_at(begin);
+
+    // the last line known to belong to the station, and a line (or the end)
+    // known not to
+    size_t last = begin;
+    size_t end = line_start(begin + 1);
+    for (size_t step = 256; end < content.size() && id_at(end) == id;
+         step *= 2) {
+      last = end;
+      end = line_start(last + step);
+    }
 
-    size_t id = str_to_number(*iterator++);
-    std::string name = *iterator++ | std::ranges::to<std::string>();
-    float longitude = str_to_double(std::string_view(*iterator++));
-    float latitude = str_to_double(std::string_view(*iterator++));
+    while (true) {
+      const size_t next = line_start(last + 1);
+      if (next >= end) {
+        break;
+      }
+      size_t middle = line_start(last + (end - last) / 2);
+      if (middle >= end) {
+        middle = next;
+      }
+      if (id_at(middle) == id) {
+        last = middle;
+      } else {
+        end = middle;
+      }
+    }
+
+    // empty lines have no id, and the parser skips them
+    if (id - 1 < counts.size()) {
+      const auto run = content.substr(begin, end - begin);
+      counts[id - 1] += scanner::count_newlines(run) + !run.ends_with('\n');
+    }
 
-    stations.emplace_back(id, name, std::make_pair(latitude, longitude));
+    begin = end;
   }
 
-  return stations;
+  return counts;
 }
 
-void parse_line(std::string_view line, const auto &callback) {
-  size_t id = str_to_number(line);
-  size_t ordinal = str_to_number(line);
-  Year year = str_to_number(line);
-  Month month = str_to_number(line);
-  Day day = str_to_number(line);
-  Temperature value = str_to_double(line);
+void process_measurements_serial(Stations &stations, std::string_view content) {
+  allocate_measurements(stations, count_measurements(stations, content));
 
-  callback(id, ordinal, year, month, day, value);
+  const auto callback = [&](const size_t id, const size_t ordinal,
+                            const Year year, const Month month, const Day day,
+                            const Temperature value) {
+    stations[id - 1].measurements.emplace_back(ordinal, year, month, day,
+                                               value);
+  };
+  scanner::for_each_record(content, callback);
 }
 
-void process_measurements_serial(Stations &stations, std::string_view content) {
-  for (const auto line : std::views::split(content, "\r\n"sv)) {
-    if (!line.empty()) {
-      const auto callback = [&](const size_t id, const size_t ordinal,
-                                const Year year, const Month month,
-                                const Day day, const Temperature value) {
-        stations[id - 1].measurements.emplace_back(ordinal, year, month, day,
-                                                   value);
-      };
-      parse_line(std::string_view(line), callback);
+/**
+ * @brief Measurements parsed from one chunk of the file.
+ *
+ * The rows are grouped into runs of consecutive measurements of the same
+ * station, which (since the file is sorted by station) are usually only one or
+ * two per chunk.
+ */
+struct ChunkMeasurements {
+  struct Run {
+    size_t station;
+    size_t begin;
+    size_t count;
+    // where the run starts in the station's measurements, set by the merge
+    size_t destination;
+  };
+
+  std::vector<Run> runs;
+  Measurements measurements;
+};
+
+using ChunksMeasurements = std::deque<ChunkMeasurements>;
+
+/**
+ * @brief Parses a line-aligned chunk of measurements into a local buffer.
+ *
+ * Doesn't touch any shared state, so any number of chunks can be parsed
+ * concurrently without locking.
+ */
+ChunkMeasurements parse_chunk(std::string_view chunk) {
+  ChunkMeasurements parsed;
+
+  // rough upper estimate based on the shortest possible line
+  parsed.measurements.reserve(chunk.size() / 20);
+
+  const auto callback = [&parsed](const size_t id, const size_t ordinal,
+                                  const Year year, const Month month,
+                                  const Day day, const Temperature value) {
+    if (parsed.runs.empty() || parsed.runs.back().station != id - 1)
+        [[unlikely]] {
+      parsed.runs.push_back({id - 1, parsed.measurements.size(), 0, 0});
     }
-  }
-}
+    parsed.runs.back().count++;
 
-void process_measurements_parallel(Stations &stations,
-                                   std::string_view content) {
-  // split the range into 2 MiB parts
-  constexpr size_t N = 1024 * 1024 * 2;
+    parsed.measurements.emplace_back(ordinal, year, month, day, value);
+  };
 
-  std::vector<std::mutex> mutexes(stations.size());
+  scanner::for_each_record(chunk, callback);
 
-  // parse each chunk in a separate thread
-  const auto process_chunk = [&content, &stations, &mutexes](const size_t i) {
-    auto chunk = content.substr(i);
+  return parsed;
+}
 
-    if (i > 0) {
-      size_t newline_index = chunk.find("\r\n"sv);
-      chunk = chunk.substr(newline_index + 2);
+/**
+ * @brief Moves the measurements of the parsed chunks into the stations.
+ *
+ * A counting pass over the runs first computes the exact size of every
+ * station and the place of each run in it, then the stations are allocated
+ * in one arena and the runs are copied to their places in parallel. The runs
+ * never overlap, so no locking is needed, and the measurements end up in the
+ * same order as in the file.
+ */
+void merge_chunks(Stations &stations, ChunksMeasurements &chunks,
+                  const ParsingOptions &options) {
+  auto sizes = stations | std::views::transform([](const auto &station) {
+                 return station.measurements.size();
+               }) |
+               std::ranges::to<std::vector>();
+  std::vector<size_t> counts(stations.size());
+
+  for (auto &chunk : chunks) {
+    for (auto &run : chunk.runs) {
+      run.destination = sizes[run.station];
+      sizes[run.station] += run.count;
+      counts[run.station] += run.count;
     }
+  }
 
-    if (chunk.size() >= N) {
-      size_t newline_index = chunk.substr(N).find("\r\n"sv);
-      if (newline_index != std::string::npos) {
-        chunk = chunk.substr(0, N + newline_index);
-      }
-    }
+  // only reserves the memory, it's touched by the resizing below
+  allocate_measurements(stations, counts);
 
-    size_t last_id = std::numeric_limits<size_t>::max();
-
-    const auto callback = [&stations, &mutexes,
-                           &last_id](const size_t id, const size_t ordinal,
-                                     const Year year, const Month month,
-                                     const Day day, const Temperature value) {
-      // hold the lock for the current station until we hit another
-      // one This exploits the fact that the data is sorted by
-      // station id
-      if (last_id != id) {
-        if (last_id != std::numeric_limits<size_t>::max()) {
-          mutexes[last_id - 1].unlock();
-        }
-        mutexes[id - 1].lock();
-        last_id = id;
-      }
+  const auto initialize = [&stations, &sizes](const size_t i) {
+    stations[i].measurements.resize(sizes[i]);
+  };
 
-      auto &measurements = stations[id - 1].measurements;
-      measurements.emplace_back(ordinal, year, month, day, value);
+  const auto scatter = [&stations](ChunkMeasurements &chunk) {
+    const auto copy_column = [](const auto &source, auto &destination,
+                                const auto &run) {
+      std::copy_n(source.begin() + run.begin, run.count,
+                  destination.begin() + run.destination);
     };
 
-    do {
-      decltype(chunk) next_chunk;
-      size_t newline_index = chunk.find("\r\n"sv);
-      if (newline_index != std::string::npos) {
-        next_chunk = chunk.substr(newline_index + 2);
-        chunk = chunk.substr(0, newline_index);
-      }
-      parse_line(chunk, callback);
-      chunk = next_chunk;
-    } while (!chunk.empty());
+    for (const auto &run : chunk.runs) {
+      const auto &source = chunk.measurements;
+      auto &destination = stations[run.station].measurements;
+      copy_column(source.ordinals, destination.ordinals, run);
+      copy_column(source.years, destination.years, run);
+      copy_column(source.months, destination.months, run);
+      copy_column(source.days, destination.days, run);
+      copy_column(source.values, destination.values, run);
+    }
+    // release the buffer as soon as possible
+    chunk = {};
+  };
+
+  if (options.parallel) {
+    // The initializing worker touches the memory first, so it ends up in its
+    // NUMA node. The later loops over the stations use the same partitioning.
+    threadpool::pool.parallel_for(
+        stations.size(), initialize,
+        threadpool::pool.affine_partitioning(stations.size(),
+                                             options.threads));
+    threadpool::pool.parallel_for(
+        chunks.size(), [&](const size_t i) { scatter(chunks[i]); },
+        {.schedule = threadpool::Schedule::Dynamic,
+         .grain = 1,
+         .max_threads = options.threads});
+  } else {
+    std::ranges::for_each(std::views::iota(0uz, stations.size()), initialize);
+    std::ranges::for_each(chunks, scatter);
+  }
+}
 
-    if (last_id != std::numeric_limits<size_t>::max()) {
-      mutexes[last_id - 1].unlock();
+void process_measurements_parallel(Stations &stations,
+                                   std::string_view content,
+                                   const ParsingOptions &options) {
+  const size_t N =
+      options.chunk_size != 0 ? options.chunk_size : DEFAULT_CHUNK_SIZE;
+
+  // A line belongs to the chunk its first byte falls into, so the chunks
+  // don't overlap and no line is lost.
+  const auto line_start_from = [&content](const size_t offset) {
+    if (offset == 0) {
+      return 0uz;
     }
+    const size_t newline_index =
+        content.find("\r\n"sv, std::max(offset, 2uz) - 2);
+    return newline_index == std::string::npos
+               ? content.size()
+               : std::min(newline_index + 2, content.size());
+  };
+
+  ChunksMeasurements chunks((content.size() + N - 1) / N);
+
+  // parse each chunk in a separate thread
+  const auto process_chunk = [&content, &chunks, N,
+                              &line_start_from](const size_t i) {
+    const size_t begin = line_start_from(i * N);
+    const size_t end = line_start_from(std::min((i + 1) * N, content.size()));
+
+    chunks[i] = parse_chunk(content.substr(begin, end - begin));
   };
 
-  auto offsets = std::views::iota(0uz, content.size()) | std::views::stride(N);
-  threadpool::pool.for_each(std::move(offsets), process_chunk);
+  threadpool::pool.parallel_for(chunks.size(), process_chunk,
+                                {.schedule = threadpool::Schedule::Dynamic,
+                                 .grain = 1,
+                                 .max_threads = options.threads});
+
+  merge_chunks(stations, chunks, options);
 }
 
 std::string read_file(const std::filesystem::path &input_filepath) {
@@ -218,17 +341,161 @@ std::string read_file(const std::filesystem::path &input_filepath) {
   return file_string;
 }
 
-void fill_measurements(Stations &stations, const std::string &file_string,
-                       bool parallel) {
+void fill_measurements(Stations &stations, std::string_view file_string,
+                       const ParsingOptions &options) {
   // skip header
   size_t newline_index = file_string.find("\r\n"sv);
 
-  std::string_view file_string_view =
-      std::string_view(file_string).substr(newline_index + 2);
+  parse_measurement_lines(stations, file_string.substr(newline_index + 2),
+                          options);
+}
 
-  if (parallel) {
-    process_measurements_parallel(stations, file_string_view);
+void parse_measurement_lines(Stations &stations, std::string_view lines,
+                             const ParsingOptions &options) {
+  if (options.parallel) {
+    process_measurements_parallel(stations, lines, options);
   } else {
-    process_measurements_serial(stations, file_string_view);
+    process_measurements_serial(stations, lines);
+  }
+}
+
+/**
+ * @brief Appends the measurements of a parsed chunk to their stations.
+ *
+ * The file is sorted by station, so the station appended to last is complete
+ * once another one follows, and its columns are shrunk to their size.
+ *
+ * @param last_station The station appended to last, updated.
+ */
+void append_chunk(Stations &stations, const ChunkMeasurements &chunk,
+                  size_t &last_station) {
+  const auto append_column = [](const auto &source, auto &destination,
+                                const auto &run) {
+    const auto begin = source.begin() + run.begin;
+    destination.insert(destination.end(), begin, begin + run.count);
+  };
+
+  for (const auto &run : chunk.runs) {
+    if (run.station != last_station && last_station < stations.size()) {
+      stations[last_station].measurements.shrink_to_fit();
+    }
+    last_station = run.station;
+
+    const auto &source = chunk.measurements;
+    auto &destination = stations[run.station].measurements;
+    append_column(source.ordinals, destination.ordinals, run);
+    append_column(source.years, destination.years, run);
+    append_column(source.months, destination.months, run);
+    append_column(source.days, destination.days, run);
+    append_column(source.values, destination.values, run);
+  }
+}
+
+void stream_measurements(Stations &stations,
+                         const std::filesystem::path &input_filepath,
+                         const ParsingOptions &options) {
+  const size_t block_size =
+      options.chunk_size != 0 ? options.chunk_size : DEFAULT_BLOCK_SIZE;
+
+  std::ifstream file(input_filepath, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open file.");
+  }
+
+  // The calling thread only reads, so with a limit of the threads it takes
+  // one of them. Without any workers left, it parses the blocks itself.
+  size_t workers = 0;
+  if (options.parallel) {
+    workers = options.threads != 0
+                  ? std::min(options.threads - 1, threadpool::pool.size())
+                  : threadpool::pool.size();
+  }
+
+  // A block that is being parsed, or waits to be appended to the stations.
+  struct PendingBlock {
+    ChunkMeasurements chunk;
+    std::atomic<bool> parsed{false};
+  };
+
+  // shared with the tasks, which still notify after the block is parsed
+  std::deque<std::shared_ptr<PendingBlock>> pending;
+
+  // The parsed blocks are appended to the stations in the order of the file
+  // as soon as all blocks before them are, so besides the stations only a
+  // bounded number of blocks is kept in memory, regardless of the size of the
+  // file. At most one block per worker is parsed at once, and another one per
+  // worker may wait for a slower block before it.
+  const size_t max_pending = 2 * workers;
+  std::counting_semaphore<> parsing(static_cast<std::ptrdiff_t>(workers));
+
+  size_t last_station = std::numeric_limits<size_t>::max();
+  const auto append_front = [&stations, &pending, &last_station] {
+    pending.front()->parsed.wait(false);
+    append_chunk(stations, pending.front()->chunk, last_station);
+    pending.pop_front();
+  };
+
+  // incomplete last line of the previous block
+  std::string carry;
+  bool skip_header = true;
+
+  while (file) {
+    const size_t capacity = carry.size() + block_size;
+    std::shared_ptr<char[]> block =
+        std::make_shared_for_overwrite<char[]>(capacity);
+
+    std::ranges::copy(carry, block.get());
+    file.read(block.get() + carry.size(), block_size);
+
+    const size_t size = carry.size() + file.gcount();
+    std::string_view content(block.get(), size);
+
+    // only pass on complete lines, the rest is prepended to the next block
+    size_t end = size;
+    if (file) {
+      const size_t newline_index = content.rfind("\r\n"sv);
+      end = newline_index == std::string::npos ? 0 : newline_index + 2;
+    }
+
+    carry = content.substr(end);
+    content = content.substr(0, end);
+
+    if (skip_header && !content.empty()) {
+      const size_t newline_index = content.find("\r\n"sv);
+      content = content.substr(std::min(newline_index + 2, content.size()));
+      skip_header = false;
+    }
+
+    if (workers == 0) {
+      append_chunk(stations, parse_chunk(content), last_station);
+      continue;
+    }
+
+    while (pending.size() >= max_pending ||
+           (!pending.empty() && pending.front()->parsed.load())) {
+      append_front();
+    }
+
+    parsing.acquire();
+    auto next = pending.emplace_back(std::make_shared<PendingBlock>());
+    // released first, so it's done before the last block is appended
+    threadpool::pool.spawn([next, &parsing, block, content] {
+      next->chunk = parse_chunk(content);
+      parsing.release();
+      next->parsed.store(true);
+      next->parsed.notify_one();
+    });
+  }
+
+  while (!pending.empty()) {
+    append_front();
+  }
+
+  if (last_station < stations.size()) {
+    stations[last_station].measurements.shrink_to_fit();
+  }
+
+  if (file.bad()) {
+    throw std::runtime_error("Failed to read file.");
   }
 }
@@ -1,9 +1,56 @@
+#pragma once
+
 #include "data.hpp"
 #include <filesystem>
+#include <string_view>
+
+// size of the parts of a mapped file parsed by a single task
+constexpr size_t DEFAULT_CHUNK_SIZE = 1024 * 1024 * 2;
+// size of the blocks read at once when streaming
+constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024 * 16;
+
+/**
+ * @brief How the measurements are parsed.
+ */
+struct ParsingOptions {
+  bool parallel = false;
+  // Size of the parts of the file parsed by a single task (parallel mode) or
+  // of the blocks read at once (streaming), 0 for the defaults above.
+  size_t chunk_size = 0;
+  // Maximum number of threads parsing at once, 0 for the whole pool.
+  size_t threads = 0;
+};
 
 std::string read_file(const std::filesystem::path &input_filepath);
 
-Stations parse_stations(const std::string &file_string);
+Stations parse_stations(std::string_view file_string);
+
+void fill_measurements(Stations &stations, std::string_view file_string,
+                       const ParsingOptions &options);
+
+/**
+ * @brief Moves the measurements of all stations into a single new arena, with
+ * room for `counts[i]` more in the station `i`.
+ */
+void allocate_measurements(Stations &stations,
+                           const std::vector<size_t> &counts);
+
+/**
+ * @brief Parses complete lines of measurements without the header, e.g. the
+ * part appended to the file since the last run.
+ */
+void parse_measurement_lines(Stations &stations, std::string_view lines,
+                             const ParsingOptions &options);
 
-void fill_measurements(Stations &stations, const std::string &file_string,
-                       bool parallel);
+/**
+ * @brief Reads and parses the measurements file in blocks.
+ *
+ * Unlike `fill_measurements`, the file doesn't have to be loaded up front.
+ * In parallel mode, completed blocks are parsed on the thread pool while the
+ * calling thread reads the following ones, overlapping the I/O with parsing.
+ * Each block is appended to the stations as soon as it and all blocks before
+ * it are parsed, so only a few of them are kept in memory at once.
+ */
+void stream_measurements(Stations &stations,
+                         const std::filesystem::path &input_filepath,
+                         const ParsingOptions &options);
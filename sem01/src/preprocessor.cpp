@@ -1,39 +1,37 @@
 #include "preprocessor.hpp"
 #include "threadpool.hpp"
-#include <algorithm>
-#include <ranges>
-
-bool valid_station(const Station &station) {
-  const auto [first_year, last_year] = std::ranges::minmax(
-      station.measurements | std::views::transform([](auto &measurement) {
-        return measurement.year;
-      }));
-
-  const auto time_span = last_year - first_year;
-
-  return time_span >= 4 && station.measurements.size() / time_span >= 300;
-}
 
+/**
+ * @brief Removes the items not flagged as valid, keeping the order of the
+ * rest, so all vectors filtered by the same flags stay aligned.
+ */
 template <typename T>
-inline void swap_remove(std::vector<T> &vector, const size_t index) {
-  vector[index] = std::move(vector.back());
-  vector.pop_back();
-}
-
-void SerialPreprocessor::preprocess_data(Stations &stations) const {
-  for (auto [i, station] :
-       stations | std::views::enumerate | std::views::reverse) {
-    if (!valid_station(station)) {
-      swap_remove(stations, i);
+void discard_invalid(std::vector<T> &items, const std::vector<char> &valid) {
+  size_t kept = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (valid[i]) {
+      if (kept != i) {
+        items[kept] = std::move(items[i]);
+      }
+      kept++;
     }
   }
+  items.erase(items.begin() + kept, items.end());
 }
 
-void ParallelPreprocessor::preprocess_data(Stations &stations) const {
-  for (auto [i, future] : threadpool::pool.transform(stations, valid_station) |
-                              std::views::enumerate | std::views::reverse) {
-    if (!future.get()) {
-      swap_remove(stations, i);
-    }
-  }
+void SerialPreprocessor::preprocess_data(
+    Stations &stations, MonthlyStatsTable &stats,
+    const std::vector<char> &valid) const {
+  discard_invalid(stations, valid);
+  discard_invalid(stats.stations(), valid);
+}
+
+void ParallelPreprocessor::preprocess_data(
+    Stations &stations, MonthlyStatsTable &stats,
+    const std::vector<char> &valid) const {
+  const auto partitioning =
+      threadpool::pool.affine_partitioning(stations.size(), mThreads);
+
+  threadpool::pool.parallel_compact(stations, valid, partitioning);
+  threadpool::pool.parallel_compact(stats.stations(), valid, partitioning);
 }
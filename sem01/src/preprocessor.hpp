@@ -2,18 +2,33 @@
 
 #include "data.hpp"
 
+/**
+ * Discards the stations without enough data, along with their stats, keeping
+ * the order of the rest. The validity is determined by `Stats` while
+ * calculating the stats, so the measurements are only scanned once. Only the
+ * views of the stats are moved, their averages stay in place.
+ */
 class Preprocessor {
 public:
   virtual ~Preprocessor() = default;
-  virtual void preprocess_data(Stations &) const = 0;
+  virtual void preprocess_data(Stations &stations, MonthlyStatsTable &stats,
+                               const std::vector<char> &valid) const = 0;
 };
 
 class SerialPreprocessor : public Preprocessor {
 public:
-  void preprocess_data(Stations &) const override;
+  void preprocess_data(Stations &stations, MonthlyStatsTable &stats,
+                       const std::vector<char> &valid) const override;
 };
 
 class ParallelPreprocessor : public Preprocessor {
 public:
-  void preprocess_data(Stations &) const override;
+  // threads: maximum number of threads to use, 0 for the whole pool
+  explicit ParallelPreprocessor(size_t threads = 0) : mThreads(threads) {}
+
+  void preprocess_data(Stations &stations, MonthlyStatsTable &stats,
+                       const std::vector<char> &valid) const override;
+
+private:
+  size_t mThreads;
 };
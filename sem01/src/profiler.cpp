@@ -0,0 +1,334 @@
+#include "profiler.hpp"
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+namespace profiling {
+
+constexpr std::array<std::pair<uint32_t, uint64_t>, EVENT_NAMES.size()>
+    EVENT_CONFIGS = {{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        // usually the last level cache, see `perf_event_open(2)`
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    }};
+
+/**
+ * @brief Kernel id of the calling thread, cached since it's a syscall.
+ */
+pid_t current_tid() {
+  thread_local const pid_t tid = gettid();
+  return tid;
+}
+
+Counters &Counters::operator+=(const Counters &other) {
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] += other.values[i];
+    available[i] = available[i] || other.available[i];
+  }
+  return *this;
+}
+
+Counters Counters::operator-(const Counters &start) const {
+  Counters difference = *this;
+  for (size_t i = 0; i < values.size(); i++) {
+    // multiplexing is extrapolated, so the estimate can also go down a bit
+    difference.values[i] =
+        values[i] > start.values[i] ? values[i] - start.values[i] : 0;
+  }
+  return difference;
+}
+
+/**
+ * @brief Opens a counter of a single event for the given thread.
+ *
+ * @return The file descriptor, or -1 if the event can't be counted.
+ */
+int open_event(const pid_t tid, const uint32_t type, const uint64_t config) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  // including the kernel when allowed, only the user space otherwise
+  for (const bool user_only : {false, true}) {
+    attr.exclude_kernel = user_only;
+    attr.exclude_hv = user_only;
+
+    const auto fd = syscall(SYS_perf_event_open, &attr, tid, -1, -1,
+                            PERF_FLAG_FD_CLOEXEC);
+    if (fd >= 0) {
+      return static_cast<int>(fd);
+    }
+  }
+
+  return -1;
+}
+
+ThreadCounters::ThreadCounters(const pid_t tid) : mTid(tid) {
+  for (size_t i = 0; i < EVENT_CONFIGS.size(); i++) {
+    mFds[i] = open_event(tid, EVENT_CONFIGS[i].first, EVENT_CONFIGS[i].second);
+  }
+}
+
+ThreadCounters::~ThreadCounters() {
+  for (const int fd : mFds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+ThreadCounters::ThreadCounters(ThreadCounters &&other) noexcept
+    : mTid(other.mTid), mFds(other.mFds) {
+  other.mFds.fill(-1);
+}
+
+ThreadCounters &ThreadCounters::operator=(ThreadCounters &&other) noexcept {
+  std::swap(mTid, other.mTid);
+  std::swap(mFds, other.mFds);
+  return *this;
+}
+
+Counters ThreadCounters::read() const {
+  Counters counters;
+
+  for (size_t i = 0; i < mFds.size(); i++) {
+    struct {
+      uint64_t value;
+      uint64_t enabled;
+      uint64_t running;
+    } data;
+
+    if (mFds[i] < 0 || ::read(mFds[i], &data, sizeof(data)) != sizeof(data)) {
+      continue;
+    }
+
+    counters.available[i] = true;
+    if (data.running != 0) {
+      counters.values[i] = static_cast<uint64_t>(
+          static_cast<double>(data.value) * data.enabled / data.running);
+    }
+  }
+
+  return counters;
+}
+
+Profiler::Profiler(const bool counters, const bool tasks)
+    : mStart(Clock::now()), mTasks(tasks) {
+  if (counters) {
+    std::error_code error;
+    for (const auto &entry :
+         std::filesystem::directory_iterator("/proc/self/task", error)) {
+      const auto name = entry.path().filename().string();
+      pid_t tid;
+      if (std::from_chars(name.data(), name.data() + name.size(), tid).ec ==
+          std::errc{}) {
+        mThreads.emplace_back(tid);
+      }
+    }
+  }
+
+  if (tasks) {
+    // the last slot is for the thread outside of the pool helping with tasks
+    mSlots = std::vector<SlotSpans>(threadpool::pool.size() + 1);
+    threadpool::pool.observe(this);
+  }
+}
+
+Profiler::~Profiler() {
+  if (mTasks) {
+    threadpool::pool.observe(nullptr);
+  }
+}
+
+const ThreadCounters *Profiler::this_thread_counters() const {
+  for (const auto &thread : mThreads) {
+    if (thread.tid() == current_tid()) {
+      return &thread;
+    }
+  }
+  return nullptr;
+}
+
+Profiler::Scope::Scope(Profiler &profiler, const std::string_view name,
+                       const bool this_thread)
+    : mProfiler(profiler), mName(name), mThisThread(this_thread) {
+  if (mThisThread) {
+    if (const auto *counters = mProfiler.this_thread_counters()) {
+      mStart.push_back(counters->read());
+    }
+  } else {
+    for (const auto &thread : mProfiler.mThreads) {
+      mStart.push_back(thread.read());
+    }
+  }
+
+  // after reading the counters, so it doesn't count towards the phase
+  mBegin = Clock::now();
+}
+
+Profiler::Scope::~Scope() {
+  const auto end = Clock::now();
+
+  Counters counters;
+  if (mThisThread) {
+    if (const auto *thread = mProfiler.this_thread_counters()) {
+      counters = thread->read() - mStart.front();
+    }
+  } else {
+    for (size_t i = 0; i < mStart.size(); i++) {
+      counters += mProfiler.mThreads[i].read() - mStart[i];
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(mProfiler.mPhasesMutex);
+  mProfiler.mPhases.push_back({mName, current_tid(), mBegin, end, counters});
+}
+
+Profiler::Scope Profiler::phase(const std::string_view name,
+                                const bool this_thread) {
+  return Scope(*this, name, this_thread);
+}
+
+void Profiler::task_finished(const size_t slot, const Clock::time_point begin,
+                             const Clock::time_point end) {
+  // the pool may have grown since the construction
+  if (slot >= mSlots.size()) {
+    return;
+  }
+
+  auto &spans = mSlots[slot];
+  if (spans.tid == 0) {
+    spans.tid = current_tid();
+  }
+  spans.spans.push_back({begin, end});
+}
+
+/**
+ * @brief The count of an event, or `n/a` if it isn't available.
+ */
+std::string format_count(const Counters &counters, const Event event) {
+  if (!counters.available[event]) {
+    return "n/a";
+  }
+  return std::to_string(counters.values[event]);
+}
+
+/**
+ * @brief Ratio of two events, or `n/a` if any of them isn't available.
+ */
+std::string format_ratio(const Counters &counters, const Event numerator,
+                         const Event denominator, const double scale = 1) {
+  if (!counters.available[numerator] || !counters.available[denominator] ||
+      counters.values[denominator] == 0) {
+    return "n/a";
+  }
+  return std::format("{:.2f}", scale * counters.values[numerator] /
+                                   counters.values[denominator]);
+}
+
+void Profiler::print_table(std::ostream &out) const {
+  std::unique_lock<std::mutex> lock(mPhasesMutex);
+
+  out << std::format("{:<12} {:>10} {:>14} {:>14} {:>6} {:>12} {:>6} {:>10}\n",
+                     "phase", "time [ms]", "cycles", "instructions", "IPC",
+                     "LLC misses", "MPKI", "ctx sw");
+
+  for (const auto &phase : mPhases) {
+    const std::chrono::duration<double, std::milli> duration =
+        phase.end - phase.begin;
+    const auto &counters = phase.counters;
+
+    out << std::format(
+        "{:<12} {:>10.3f} {:>14} {:>14} {:>6} {:>12} {:>6} {:>10}\n",
+        phase.name, duration.count(), format_count(counters, Cycles),
+        format_count(counters, Instructions),
+        format_ratio(counters, Instructions, Cycles),
+        format_count(counters, LlcMisses),
+        format_ratio(counters, LlcMisses, Instructions, 1000),
+        format_count(counters, ContextSwitches));
+  }
+
+  if (!mThreads.empty() && !mPhases.empty() &&
+      !mPhases.front().counters.available[Cycles]) {
+    out << "Hardware counters are not available, check "
+           "/proc/sys/kernel/perf_event_paranoid.\n";
+  }
+}
+
+void Profiler::write_trace(const std::filesystem::path &file) const {
+  std::ofstream out(file);
+  if (!out.is_open()) {
+    throw std::runtime_error(
+        std::format("Failed to open the trace file {}.", file.string()));
+  }
+
+  const pid_t pid = getpid();
+  const auto timestamp = [this](const Clock::time_point time) {
+    return std::chrono::duration<double, std::micro>(time - mStart).count();
+  };
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  out << std::format("{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": {}, "
+                     "\"tid\": {}, \"args\": {{\"name\": \"main\"}}}}",
+                     pid, pid);
+
+  for (size_t slot = 0; slot < mSlots.size(); slot++) {
+    const auto tid = mSlots[slot].tid;
+    if (tid == 0 || tid == pid) {
+      continue;
+    }
+    out << std::format(",\n{{\"name\": \"thread_name\", \"ph\": \"M\", "
+                       "\"pid\": {}, \"tid\": {}, \"args\": {{\"name\": "
+                       "\"worker {}\"}}}}",
+                       pid, tid, slot);
+  }
+
+  std::unique_lock<std::mutex> lock(mPhasesMutex);
+
+  for (const auto &phase : mPhases) {
+    std::string args;
+    for (size_t i = 0; i < EVENT_NAMES.size(); i++) {
+      if (phase.counters.available[i]) {
+        args += std::format("{}\"{}\": {}", args.empty() ? "" : ", ",
+                            EVENT_NAMES[i], phase.counters.values[i]);
+      }
+    }
+
+    out << std::format(",\n{{\"name\": \"{}\", \"cat\": \"phase\", \"ph\": "
+                       "\"X\", \"ts\": {:.3f}, \"dur\": {:.3f}, \"pid\": {}, "
+                       "\"tid\": {}, \"args\": {{{}}}}}",
+                       phase.name, timestamp(phase.begin),
+                       timestamp(phase.end) - timestamp(phase.begin), pid,
+                       phase.tid, args);
+  }
+
+  for (const auto &slot : mSlots) {
+    for (const auto &span : slot.spans) {
+      out << std::format(",\n{{\"name\": \"task\", \"cat\": \"task\", \"ph\": "
+                         "\"X\", \"ts\": {:.3f}, \"dur\": {:.3f}, \"pid\": {}, "
+                         "\"tid\": {}}}",
+                         timestamp(span.begin),
+                         timestamp(span.end) - timestamp(span.begin), pid,
+                         slot.tid);
+    }
+  }
+
+  out << "\n]}\n";
+
+  if (!out) {
+    throw std::runtime_error(
+        std::format("Failed to write the trace file {}.", file.string()));
+  }
+}
+
+} // namespace profiling
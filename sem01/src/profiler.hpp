@@ -0,0 +1,176 @@
+#pragma once
+
+#include "threadpool.hpp"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * Optional instrumentation of the phases of the pipeline: hardware counters
+ * read through `perf_event_open` and a timeline of the tasks run by the
+ * threadpool.
+ */
+namespace profiling {
+
+enum Event : size_t { Cycles, Instructions, LlcMisses, ContextSwitches };
+
+constexpr std::array<std::string_view, 4> EVENT_NAMES = {
+    "cycles", "instructions", "llc_misses", "context_switches"};
+
+/**
+ * @brief Counts of the events, of a single thread or summed over more.
+ */
+struct Counters {
+  std::array<uint64_t, EVENT_NAMES.size()> values{};
+  // events the kernel refused to count (e.g. no PMU in a VM, or a too strict
+  // `perf_event_paranoid`) stay unavailable
+  std::array<bool, EVENT_NAMES.size()> available{};
+
+  Counters &operator+=(const Counters &other);
+  Counters operator-(const Counters &start) const;
+};
+
+/**
+ * @class ThreadCounters
+ * @brief The events of a single thread, counted since the construction.
+ */
+class ThreadCounters {
+public:
+  explicit ThreadCounters(pid_t tid);
+  ~ThreadCounters();
+
+  ThreadCounters(const ThreadCounters &) = delete;
+  ThreadCounters &operator=(const ThreadCounters &) = delete;
+
+  ThreadCounters(ThreadCounters &&other) noexcept;
+  ThreadCounters &operator=(ThreadCounters &&other) noexcept;
+
+  /**
+   * @brief Current counts, scaled up if the kernel had to multiplex the
+   * counters.
+   */
+  Counters read() const;
+
+  pid_t tid() const { return mTid; }
+
+private:
+  pid_t mTid;
+  std::array<int, EVENT_NAMES.size()> mFds;
+};
+
+/**
+ * @class Profiler
+ * @brief Records the duration and counters of the phases and the spans of
+ * the tasks run by the pool.
+ *
+ * The counters are opened for all threads of the process that exist at the
+ * construction, so it has to be created after the pool is resized.
+ */
+class Profiler : public threadpool::TaskObserver {
+public:
+  /**
+   * @param counters Whether to read the hardware counters.
+   * @param tasks Whether to record the spans of the tasks of the pool.
+   */
+  Profiler(bool counters, bool tasks);
+
+  /**
+   * @brief Stops observing the pool, the tasks still running have to finish
+   * before the destruction, e.g. by `join()`-ing the pool.
+   */
+  ~Profiler() override;
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  /**
+   * @class Scope
+   * @brief A running phase, recorded once it goes out of scope.
+   */
+  class Scope {
+  public:
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    Scope(Profiler &profiler, std::string_view name, bool this_thread);
+
+    Profiler &mProfiler;
+    std::string_view mName;
+    bool mThisThread;
+    Clock::time_point mBegin;
+    std::vector<Counters> mStart;
+
+    friend Profiler;
+  };
+
+  /**
+   * @brief Starts a phase, which ends when the returned scope is destroyed.
+   *
+   * @param name Name of the phase, has to outlive the profiler.
+   * @param this_thread Count only the events of the calling thread, for
+   * a phase running concurrently with other ones. Otherwise the events of all
+   * threads are summed.
+   */
+  [[nodiscard]] Scope phase(std::string_view name, bool this_thread = false);
+
+  void task_finished(size_t slot, Clock::time_point begin,
+                     Clock::time_point end) override;
+
+  /**
+   * @brief Prints the duration and the counters of each phase.
+   */
+  void print_table(std::ostream &out) const;
+
+  /**
+   * @brief Writes the phases and the tasks in the Chrome trace event format,
+   * viewable in `chrome://tracing` or Perfetto.
+   *
+   * @throws std::runtime_error if the file can't be written.
+   */
+  void write_trace(const std::filesystem::path &file) const;
+
+private:
+  struct PhaseRecord {
+    std::string_view name;
+    pid_t tid;
+    Clock::time_point begin;
+    Clock::time_point end;
+    Counters counters;
+  };
+
+  struct Span {
+    Clock::time_point begin;
+    Clock::time_point end;
+  };
+
+  // written only by the thread of the slot, so it doesn't need a lock
+  struct alignas(64) SlotSpans {
+    pid_t tid = 0;
+    std::vector<Span> spans;
+  };
+
+  /**
+   * @brief Counters of the calling thread, if it existed at the construction.
+   */
+  const ThreadCounters *this_thread_counters() const;
+
+  Clock::time_point mStart;
+  std::vector<ThreadCounters> mThreads;
+  bool mTasks;
+
+  std::vector<SlotSpans> mSlots;
+
+  mutable std::mutex mPhasesMutex;
+  std::vector<PhaseRecord> mPhases;
+};
+
+} // namespace profiling
@@ -0,0 +1,181 @@
+#include "raster.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+namespace raster {
+
+void fill_disc(Image &image, const float x, const float y, const float radius,
+               const uint8_t index, const size_t begin, const size_t end) {
+  const auto first = static_cast<long>(std::ceil(y - radius - 0.5f));
+  const auto last = static_cast<long>(std::floor(y + radius - 0.5f));
+
+  for (long row = std::max(first, static_cast<long>(begin));
+       row <= std::min(last, static_cast<long>(end) - 1); row++) {
+    // half of the chord through the centers of the pixels of the row
+    const float dy = static_cast<float>(row) + 0.5f - y;
+    const float half = std::sqrt(radius * radius - dy * dy);
+
+    const long left = std::max(0l, std::lround(std::ceil(x - half - 0.5f)));
+    const long right =
+        std::min(static_cast<long>(image.width()) - 1,
+                 std::lround(std::floor(x + half - 0.5f)));
+    if (left <= right) {
+      std::fill(image.row(row) + left, image.row(row) + right + 1, index);
+    }
+  }
+}
+
+/**
+ * @brief Length of the run of the same index starting at `row[0]`, at most
+ * `limit`, comparing 8 indices at a time.
+ */
+size_t run_length(const uint8_t *row, const size_t limit) {
+  const uint64_t same = 0x0101010101010101ull * row[0];
+
+  size_t run = 1;
+  for (; run + 8 <= limit; run += 8) {
+    uint64_t indices;
+    std::memcpy(&indices, row + run, sizeof(indices));
+    // the first index in memory in the lowest byte
+    if constexpr (std::endian::native == std::endian::big) {
+      indices = std::byteswap(indices);
+    }
+
+    const uint64_t different = indices ^ same;
+    if (different != 0) {
+      return run + std::countr_zero(different) / 8;
+    }
+  }
+
+  while (run < limit && row[run] == row[0]) {
+    run++;
+  }
+  return run;
+}
+
+/**
+ * @brief Writes the runs of a row, followed by the end of the line.
+ *
+ * Repeated indices are stored as (count, index) pairs. Anything else goes
+ * into absolute runs up to the next repetition of three, which is where a
+ * pair starts to be shorter.
+ *
+ * @return The end of the written data.
+ */
+char *encode_row(const uint8_t *row, const size_t width, char *out) {
+  constexpr size_t MAX_RUN = 255;
+
+  const auto repeated = [&](const size_t i) {
+    return i + 2 < width && row[i] == row[i + 1] && row[i] == row[i + 2];
+  };
+
+  size_t i = 0;
+  while (i < width) {
+    const size_t run = run_length(row + i, std::min(MAX_RUN, width - i));
+
+    if (run >= 2) {
+      *out++ = static_cast<char>(run);
+      *out++ = static_cast<char>(row[i]);
+      i += run;
+      continue;
+    }
+
+    size_t literal = 1;
+    while (i + literal < width && literal < MAX_RUN && !repeated(i + literal)) {
+      literal++;
+    }
+
+    // an absolute run has at least 3 indices, padded to an even length
+    if (literal < 3) {
+      for (size_t j = i; j < i + literal; j++) {
+        *out++ = 1;
+        *out++ = static_cast<char>(row[j]);
+      }
+    } else {
+      *out++ = 0;
+      *out++ = static_cast<char>(literal);
+      out = std::copy(row + i, row + i + literal, out);
+      if (literal % 2 == 1) {
+        *out++ = 0;
+      }
+    }
+    i += literal;
+  }
+
+  // end of the line
+  *out++ = 0;
+  *out++ = 0;
+  return out;
+}
+
+std::string encode_rle8(const Image &image, const size_t begin,
+                        const size_t end) {
+  // at worst two bytes per pixel, as runs of a single index
+  const size_t max_size = (2 * image.width() + 2) * (end - begin);
+
+  std::string data;
+  data.resize_and_overwrite(max_size, [&](char *const first, size_t) {
+    char *out = first;
+    for (size_t y = end; y-- > begin;) {
+      out = encode_row(image.row(y), image.width(), out);
+    }
+    return out - first;
+  });
+
+  return data;
+}
+
+/**
+ * @brief Appends the value in little endian.
+ */
+void append(std::string &out, const uint32_t value, const size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out += static_cast<char>(value >> (8 * i));
+  }
+}
+
+std::string bmp_header(const size_t width, const size_t height,
+                       const Palette &palette, const size_t data_size) {
+  constexpr size_t FILE_HEADER_SIZE = 14;
+  constexpr size_t INFO_HEADER_SIZE = 40;
+  constexpr uint32_t BI_RLE8 = 1;
+  // 72 DPI
+  constexpr uint32_t PIXELS_PER_METER = 2835;
+
+  const size_t size =
+      FILE_HEADER_SIZE + INFO_HEADER_SIZE + palette.size() * 4;
+
+  std::string header;
+  header.reserve(size);
+
+  header += "BM";
+  append(header, size + data_size, 4);
+  append(header, 0, 4);
+  append(header, size, 4);
+
+  append(header, INFO_HEADER_SIZE, 4);
+  append(header, width, 4);
+  // positive, so the rows are stored bottom-up as RLE8 requires
+  append(header, height, 4);
+  append(header, 1, 2);
+  append(header, 8, 2);
+  append(header, BI_RLE8, 4);
+  append(header, data_size, 4);
+  append(header, PIXELS_PER_METER, 4);
+  append(header, PIXELS_PER_METER, 4);
+  append(header, palette.size(), 4);
+  append(header, 0, 4);
+
+  for (const auto &color : palette) {
+    header += static_cast<char>(color.b);
+    header += static_cast<char>(color.g);
+    header += static_cast<char>(color.r);
+    header += '\0';
+  }
+
+  return header;
+}
+
+} // namespace raster
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "colors.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Raster images of the maps, as 8-bit indexed bitmaps.
+ *
+ * All colors of a map come from a single ramp, so 256 palette entries are
+ * plenty, and an image takes a quarter of its RGBA size. The BMP files are
+ * RLE8 compressed, which shrinks the runs of the same color along the rows.
+ */
+namespace raster {
+
+using Palette = std::array<Color, 256>;
+
+/**
+ * @class Image
+ * @brief Palette indices of the pixels, by rows from the top.
+ */
+class Image {
+public:
+  Image(size_t width, size_t height)
+      : mWidth(width), mHeight(height), mPixels(width * height) {}
+
+  size_t width() const { return mWidth; }
+  size_t height() const { return mHeight; }
+
+  uint8_t *row(const size_t y) { return mPixels.data() + y * mWidth; }
+  const uint8_t *row(const size_t y) const {
+    return mPixels.data() + y * mWidth;
+  }
+
+private:
+  size_t mWidth;
+  size_t mHeight;
+  std::vector<uint8_t> mPixels;
+};
+
+/**
+ * @brief Sets the pixels whose centers lie in the disc, only in the rows
+ * `[begin, end)` and within the image.
+ */
+void fill_disc(Image &image, float x, float y, float radius, uint8_t index,
+               size_t begin, size_t end);
+
+/**
+ * @brief Encodes the rows `[begin, end)` as RLE8 data, from the bottom one
+ * up.
+ *
+ * The data of a whole bottom-up BMP is that of its bands of rows from the
+ * bottom one up, followed by `RLE8_END`, so the bands can be encoded
+ * separately.
+ */
+std::string encode_rle8(const Image &image, size_t begin, size_t end);
+
+constexpr std::string_view RLE8_END{"\0\1", 2};
+
+/**
+ * @brief File header, info header and palette of a BMP whose RLE8 data of
+ * the given size follows right after them.
+ */
+std::string bmp_header(size_t width, size_t height, const Palette &palette,
+                       size_t data_size);
+
+} // namespace raster
@@ -1,12 +1,28 @@
 #include "renderer.hpp"
+#include "spatial.hpp"
 #include "threadpool.hpp"
 #include "utils.hpp"
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
 #include <format>
 #include <fstream>
+#include <iostream>
+#include <limits>
 #include <ranges>
+#include <span>
+#include <stdexcept>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <vector>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 Renderer::Renderer() {
   std::ifstream file("czmap.svg");
 
@@ -21,46 +37,128 @@ Renderer::Renderer() {
 
 std::string Renderer::HEADER;
 
-std::string Renderer::render_station(const Station &station,
-                                     const Temperature temperature) const {
+constexpr Color BLUE{0, 0, 255, 255};
+constexpr Color YELLOW{255, 255, 0, 255};
+constexpr Color RED{255, 0, 0, 255};
+
+/**
+ * @brief Average of the month over the years with measurements in it, NaN if
+ * there are none.
+ */
+Temperature month_average(const StationMonthlyStats &stats,
+                          const size_t month) {
+  Temperature total{0};
+  size_t count = 0;
+  for (const auto average : stats.month_averages(month)) {
+    if (!std::isnan(average)) {
+      total += average;
+      count++;
+    }
+  }
+  return total / count;
+}
+
+void Renderer::project_stations(const Stations &stations) {
   const auto [upper_left_lat, upper_left_lon] = UPPER_LEFT_CORNER;
   const auto [lower_right_lat, lower_right_lon] = LOWER_RIGHT_CORNER;
 
-  const auto y = map_range(upper_left_lat, lower_right_lat, 0, MAP_HEIGHT,
-                           station.location.first);
-  const auto x = map_range(upper_left_lon, lower_right_lon, 0, MAP_WIDTH,
-                           station.location.second);
+  mPositions.clear();
+  mPositions.reserve(stations.size());
+
+  for (const auto &station : stations) {
+    mPositions.push_back(
+        {map_range(upper_left_lon, lower_right_lon, 0, MAP_WIDTH,
+                   station.location.second),
+         map_range(upper_left_lat, lower_right_lat, 0, MAP_HEIGHT,
+                   station.location.first)});
+  }
+}
 
+void Renderer::render_station(std::string &buffer, const MapPosition &position,
+                              const Temperature temperature) const {
   const auto value = map_range(mMinmax.min, mMinmax.max, -1, 1, temperature);
+  const auto color = lerpColor3(BLUE, YELLOW, RED, value);
 
-  constexpr Color BLUE{0, 0, 255, 255};
-  constexpr Color YELLOW{255, 255, 0, 255};
-  constexpr Color RED{255, 0, 0, 255};
+  // formatted right after the previous circles, without a temporary string
+  const size_t size = buffer.size();
+  buffer.resize_and_overwrite(
+      size + MAX_CIRCLE_SIZE, [&](char *data, const size_t new_size) {
+        return std::format_to_n(data + size, new_size - size, TEMPLATE,
+                                position.y, position.x, color.r, color.g,
+                                color.b)
+                   .out -
+               data;
+      });
+}
 
-  const auto color = lerpColor3(BLUE, YELLOW, RED, value);
+/**
+ * @brief Writes the parts into a new file, all with one system call unless
+ * it's interrupted.
+ *
+ * @throws std::runtime_error if the file cannot be written.
+ */
+void write_file(const std::string &file_name,
+                const std::array<std::string_view, 3> &parts) {
+  const int fd =
+      open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open output file.");
+  }
 
-  return std::format(TEMPLATE, y, x, color.r, color.g, color.b);
-};
+  std::array<iovec, 3> vectors;
+  for (size_t i = 0; i < parts.size(); i++) {
+    vectors[i] = {const_cast<char *>(parts[i].data()), parts[i].size()};
+  }
 
-void Renderer::render_month_to_file(
-    const Stations &stations, const std::vector<StationMonthlyStats> &stats,
-    const size_t month, const std::string &file_name) const {
-  std::ofstream svg_file(file_name);
-  svg_file << HEADER;
+  iovec *next = vectors.data();
+  size_t remaining = vectors.size();
 
-  for (const auto [station, station_stats] : std::views::zip(stations, stats)) {
-    const auto &[averages, _] = station_stats;
+  while (remaining > 0) {
+    const ssize_t written = writev(fd, next, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      throw std::runtime_error("Failed to write output file.");
+    }
 
-    const auto month_averages = averages[month] | std::views::values;
+    // skip the parts written whole, and the written start of the next one
+    auto size = static_cast<size_t>(written);
+    while (remaining > 0 && size >= next->iov_len) {
+      size -= next->iov_len;
+      next++;
+      remaining--;
+    }
+    if (remaining > 0) {
+      next->iov_base = static_cast<char *>(next->iov_base) + size;
+      next->iov_len -= size;
+    }
+  }
+
+  if (close(fd) < 0) {
+    throw std::runtime_error("Failed to write output file.");
+  }
+}
 
-    const auto average =
-        std::ranges::fold_left(month_averages, Temperature{0}, std::plus{}) /
-        month_averages.size();
+void Renderer::render_month_to_file(const MonthlyStatsTable &stats,
+                                    const size_t month,
+                                    const std::string &file_name) const {
+  // keeps its capacity for the next month rendered by the thread
+  thread_local std::string body;
+  body.clear();
 
-    svg_file << render_station(station, average);
+  for (const auto [position, station_stats] :
+       std::views::zip(mPositions, stats)) {
+    render_station(body, position, month_average(station_stats, month));
   }
 
-  svg_file << FOOTER;
+  // the bodies of the threadpool loops mustn't throw
+  try {
+    write_file(file_name, {HEADER, body, FOOTER});
+  } catch (const std::runtime_error &e) {
+    std::cerr << std::format("{} ({})\n", e.what(), file_name);
+  }
 }
 
 constexpr std::array<std::string_view, 12> MONTHS = {
@@ -68,30 +166,566 @@ constexpr std::array<std::string_view, 12> MONTHS = {
     "cervenec", "srpen", "zari",   "rijen", "listopad", "prosinec"};
 
 std::ranges::min_max_result<Temperature>
-minmax_station_averages(const std::vector<StationMonthlyStats> &stats) {
-  return std::ranges::minmax(std::views::keys(stats) | std::views::join |
-                             std::views::transform(std::views::values) |
-                             std::views::join);
+minmax_station_averages(const MonthlyStatsTable &stats) {
+  // the extremes of the months are the extremes of all the averages
+  std::ranges::min_max_result<Temperature> minmax{
+      std::numeric_limits<Temperature>::infinity(),
+      -std::numeric_limits<Temperature>::infinity()};
+
+  for (const auto &station_stats : stats) {
+    for (const auto [min, max] : station_stats.minmaxes) {
+      minmax.min = std::min(minmax.min, min);
+      minmax.max = std::max(minmax.max, max);
+    }
+  }
+
+  return minmax;
 }
 
-void SerialRenderer::render_months(
-    const Stations &stations, const std::vector<StationMonthlyStats> &stats) {
+void SerialRenderer::render_months(const Stations &stations,
+                                   const MonthlyStatsTable &stats) {
   mMinmax = minmax_station_averages(stats);
+  project_stations(stations);
 
   for (const auto [i, month] : MONTHS | std::views::enumerate) {
-    render_month_to_file(stations, stats, i,
-                         std::format("output/{}.svg", month));
+    render_month_to_file(stats, i, std::format("output/{}.svg", month));
   }
 }
 
-void ParallelRenderer::render_months(
-    const Stations &stations, const std::vector<StationMonthlyStats> &stats) {
+void ParallelRenderer::render_months(const Stations &stations,
+                                     const MonthlyStatsTable &stats) {
   mMinmax = minmax_station_averages(stats);
+  project_stations(stations);
 
-  threadpool::pool.for_each(
-      MONTHS | std::views::enumerate, [&, this](const auto item) {
-        const auto &[i, month] = item;
-        render_month_to_file(stations, stats, i,
-                             std::format("output/{}.svg", month));
-      });
+  threadpool::pool.parallel_for(
+      MONTHS.size(),
+      [&, this](const size_t i) {
+        render_month_to_file(stats, i,
+                             std::format("output/{}.svg", MONTHS[i]));
+      },
+      {.schedule = threadpool::Schedule::Dynamic,
+       .grain = 1,
+       .max_threads = mThreads});
+}
+
+/**
+ * @brief The outline color followed by the ramp of the SVG maps from the
+ * lowest to the highest temperature.
+ */
+const raster::Palette &palette() {
+  static const raster::Palette palette = [] {
+    raster::Palette palette;
+    palette[0] = {32, 32, 32, 255};
+    for (size_t i = 1; i < palette.size(); i++) {
+      const auto t = static_cast<float>(i - 1) / (palette.size() - 2);
+      palette[i] = lerpColor3(BLUE, YELLOW, RED, 2 * t - 1);
+    }
+    return palette;
+  }();
+  return palette;
+}
+
+/**
+ * @brief Maps the temperatures linearly onto the indices of the ramp in the
+ * palette.
+ *
+ * Without a range (a single station, equal averages or none at all) every
+ * temperature gets the middle of the ramp.
+ */
+class ColorScale {
+public:
+  explicit ColorScale(const std::ranges::minmax_result<Temperature> &minmax)
+      : mScale(scale(minmax)),
+        // rounds to the nearest index when truncated
+        mOffset(mScale != 0.f
+                    ? 1.5f - static_cast<float>(minmax.min) * mScale
+                    : 128.f) {}
+
+  /**
+   * @brief Position of the temperature on the ramp, whose integer part is the
+   * index of its color.
+   */
+  float position(const float temperature) const {
+    return std::clamp(temperature * mScale + mOffset, 1.f, 255.f);
+  }
+
+  uint8_t operator()(const float temperature) const {
+    return static_cast<uint8_t>(position(temperature));
+  }
+
+private:
+  static float scale(const std::ranges::minmax_result<Temperature> &minmax) {
+    const float scale = 254.f / static_cast<float>(minmax.max - minmax.min);
+    return std::isfinite(scale) && scale > 0 ? scale : 0.f;
+  }
+
+  float mScale;
+  float mOffset;
+};
+
+/**
+ * @brief A station with measurements in the month.
+ */
+struct FieldSource {
+  MapPosition position;
+  float average;
+};
+
+/**
+ * @brief Inverse distance weighted average of the sources at the point, with
+ * the weights falling off with the squared distance.
+ */
+float interpolate(const std::vector<FieldSource> &sources, const float x,
+                  const float y) {
+  // a point right at a source takes its value, without dividing by zero
+  constexpr float MIN_SQUARED_DISTANCE = 1e-6f;
+
+  float weighted = 0;
+  float weights = 0;
+
+  for (const auto &[position, average] : sources) {
+    const float dx = position.x - x;
+    const float dy = position.y - y;
+    const float weight =
+        1 / std::max(dx * dx + dy * dy, MIN_SQUARED_DISTANCE);
+    weighted += weight * average;
+    weights += weight;
+  }
+
+  return weighted / weights;
+}
+
+/**
+ * @brief Writes the BMP map of each month from the RLE8 data of its bands of
+ * rows, stored by month and from the top band down.
+ *
+ * A file that cannot be written is reported to `std::cerr`, like the SVG maps.
+ */
+void write_bitmaps(const std::vector<std::string> &encoded, const size_t bands,
+                   const threadpool::Partitioning &partitioning) {
+  threadpool::pool.parallel_for(
+      MONTHS.size(),
+      [&](const size_t month) {
+        // the bands of the month from the bottom one up
+        const auto month_bands =
+            std::span(encoded).subspan(month * bands, bands);
+        std::string data;
+        data.reserve(std::ranges::fold_left(
+            month_bands, raster::RLE8_END.size(),
+            [](const size_t size, const auto &band) {
+              return size + band.size();
+            }));
+        for (const auto &band : month_bands | std::views::reverse) {
+          data += band;
+        }
+        data += raster::RLE8_END;
+
+        const auto header = raster::bmp_header(RASTER_WIDTH, RASTER_HEIGHT,
+                                               palette(), data.size());
+        const auto file_name = std::format("output/{}.bmp", MONTHS[month]);
+        try {
+          write_file(file_name, {header, data, {}});
+        } catch (const std::runtime_error &e) {
+          std::cerr << std::format("{} ({})\n", e.what(), file_name);
+        }
+      },
+      partitioning);
+}
+
+void RasterRenderer::render_months(const Stations &stations,
+                                   const MonthlyStatsTable &stats) {
+  // samples at the corners of the tiles, including the last partial ones
+  constexpr size_t COLUMNS = (RASTER_WIDTH + TILE_SIZE - 1) / TILE_SIZE + 1;
+  constexpr size_t ROWS = (RASTER_HEIGHT + TILE_SIZE - 1) / TILE_SIZE + 1;
+  constexpr size_t BANDS = (RASTER_HEIGHT + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+  mMinmax = minmax_station_averages(stats);
+  project_stations(stations);
+  const ColorScale color_index(mMinmax);
+
+  std::array<std::vector<FieldSource>, MONTHS.size()> sources;
+  for (size_t month = 0; month < MONTHS.size(); month++) {
+    for (const auto [position, station_stats] :
+         std::views::zip(mPositions, stats)) {
+      const auto average = month_average(station_stats, month);
+      if (!std::isnan(average)) {
+        sources[month].push_back({position, static_cast<float>(average)});
+      }
+    }
+  }
+
+  const threadpool::Partitioning partitioning{
+      .schedule = threadpool::Schedule::Dynamic,
+      .grain = 1,
+      .max_threads = mThreads};
+
+  std::array<std::vector<float>, MONTHS.size()> samples;
+  for (auto &month_samples : samples) {
+    month_samples.resize(COLUMNS * ROWS);
+  }
+
+  threadpool::pool.parallel_for(
+      MONTHS.size() * ROWS,
+      [&](const size_t i) {
+        const size_t month = i / ROWS;
+        const size_t row = i % ROWS;
+        if (sources[month].empty()) {
+          return;
+        }
+        for (size_t column = 0; column < COLUMNS; column++) {
+          samples[month][row * COLUMNS + column] =
+              color_index.position(interpolate(
+                  sources[month], static_cast<float>(column * TILE_SIZE),
+                  static_cast<float>(row * TILE_SIZE)));
+        }
+      },
+      partitioning);
+
+  std::vector<raster::Image> images(MONTHS.size(),
+                                    raster::Image(RASTER_WIDTH, RASTER_HEIGHT));
+  std::vector<std::string> encoded(MONTHS.size() * BANDS);
+
+  threadpool::pool.parallel_for(
+      MONTHS.size() * BANDS,
+      [&](const size_t i) {
+        const size_t month = i / BANDS;
+        const size_t begin = i % BANDS * BAND_HEIGHT;
+        const size_t end = std::min(begin + BAND_HEIGHT, RASTER_HEIGHT);
+        auto &image = images[month];
+        // all in the outline color for a month without measurements, as its
+        // samples are left at 0
+        const auto &month_samples = samples[month];
+
+        // The positions on the ramp of the field of the row at each column
+        // of the samples, in 16.16 fixed point. Interpolating between the
+        // samples never leaves the ramp, so the pixels need no clamping.
+        std::array<int32_t, COLUMNS> columns;
+        for (size_t y = begin; y < end; y++) {
+          const float *above = &month_samples[y / TILE_SIZE * COLUMNS];
+          const float *below = above + COLUMNS;
+          const float fy = static_cast<float>(y % TILE_SIZE) / TILE_SIZE;
+          for (size_t column = 0; column < COLUMNS; column++) {
+            columns[column] = static_cast<int32_t>(
+                (above[column] + fy * (below[column] - above[column])) *
+                65536);
+          }
+
+          // a tile at a time, stepping the field along it
+          uint8_t *row = image.row(y);
+          for (size_t x = 0; x < RASTER_WIDTH; x += TILE_SIZE) {
+            const size_t column = x / TILE_SIZE;
+            const int32_t left = columns[column];
+            const int32_t step =
+                (columns[column + 1] - left) / static_cast<int32_t>(TILE_SIZE);
+            const size_t size = std::min(TILE_SIZE, RASTER_WIDTH - x);
+            for (size_t pixel = 0; pixel < size; pixel++) {
+              row[x + pixel] = static_cast<uint8_t>(
+                  (left + static_cast<int32_t>(pixel) * step) >> 16);
+            }
+          }
+        }
+
+        // in the order of the stations, as the circles of the SVG maps
+        for (const auto &[position, average] : sources[month]) {
+          raster::fill_disc(image, position.x, position.y, DOT_RADIUS,
+                            OUTLINE_INDEX, begin, end);
+          raster::fill_disc(image, position.x, position.y,
+                            DOT_RADIUS - OUTLINE_WIDTH, color_index(average),
+                            begin, end);
+        }
+
+        encoded[i] = raster::encode_rle8(image, begin, end);
+      },
+      partitioning);
+
+  write_bitmaps(encoded, BANDS, partitioning);
+}
+
+/**
+ * @brief The candidates nearest to a pixel so far, by ascending squared
+ * distance.
+ */
+struct Neighbours {
+  std::array<float, HeatmapRenderer::NEIGHBOURS> distances;
+  std::array<uint32_t, HeatmapRenderer::NEIGHBOURS> candidates;
+
+  void clear() {
+    distances.fill(std::numeric_limits<float>::infinity());
+    candidates.fill(0);
+  }
+
+  float furthest() const { return distances.back(); }
+
+  /**
+   * @brief Inserts the candidate if it's nearer than the furthest one.
+   */
+  void insert(const float distance, const uint32_t candidate) {
+    size_t i = distances.size() - 1;
+    if (!(distance < distances[i])) {
+      return;
+    }
+    for (; i > 0 && distances[i - 1] > distance; i--) {
+      distances[i] = distances[i - 1];
+      candidates[i] = candidates[i - 1];
+    }
+    distances[i] = distance;
+    candidates[i] = candidate;
+  }
+};
+
+/**
+ * @brief Finds the nearest of the candidates by inserting them one by one.
+ */
+void nearest_scalar(const float *xs, const float *ys, const size_t count,
+                    const float x, const float y, Neighbours &neighbours) {
+  for (size_t i = 0; i < count; i++) {
+    const float dx = xs[i] - x;
+    const float dy = ys[i] - y;
+    neighbours.insert(dx * dx + dy * dy, static_cast<uint32_t>(i));
+  }
+}
+
+#if defined(__x86_64__)
+
+/**
+ * @brief Finds the nearest of the candidates by ranking each of them by the
+ * number of nearer ones, 8 at a time.
+ *
+ * A tile has only about a dozen candidates, so comparing all pairs without a
+ * branch is faster than the sorted insertion with its mispredicted shifts.
+ * Equally distant candidates are ranked by their order, as with the insertion.
+ */
+__attribute__((target("avx2"))) void
+nearest_avx2(const float *xs, const float *ys, const size_t count,
+             const float x, const float y, Neighbours &neighbours) {
+  // more candidates than this are rare, and better off with the insertion
+  constexpr size_t MAX_RANKED = 64;
+
+  const size_t padded = (count + 7) / 8 * 8;
+  if (padded > MAX_RANKED) {
+    nearest_scalar(xs, ys, count, x, y, neighbours);
+    return;
+  }
+
+  const __m256 point_x = _mm256_set1_ps(x);
+  const __m256 point_y = _mm256_set1_ps(y);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  // the padding is at infinity, so it's never nearer than a candidate
+  alignas(32) std::array<float, MAX_RANKED> distances;
+  for (size_t i = 0; i < padded; i += 8) {
+    const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), point_x);
+    const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), point_y);
+    _mm256_store_ps(distances.data() + i, _mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                                        _mm256_mul_ps(dy, dy)));
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const __m256 distance = _mm256_set1_ps(distances[i]);
+    const __m256i index = _mm256_set1_epi32(static_cast<int>(i));
+
+    unsigned rank = 0;
+    for (size_t j = 0; j < padded; j += 8) {
+      const __m256 other = _mm256_load_ps(distances.data() + j);
+      const __m256i other_index =
+          _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int>(j)));
+      const __m256 nearer = _mm256_or_ps(
+          _mm256_cmp_ps(other, distance, _CMP_LT_OQ),
+          _mm256_and_ps(_mm256_cmp_ps(other, distance, _CMP_EQ_OQ),
+                        _mm256_castsi256_ps(
+                            _mm256_cmpgt_epi32(index, other_index))));
+      rank += std::popcount(
+          static_cast<unsigned>(_mm256_movemask_ps(nearer)));
+    }
+
+    if (rank < neighbours.distances.size()) {
+      neighbours.distances[rank] = distances[i];
+      neighbours.candidates[rank] = static_cast<uint32_t>(i);
+    }
+  }
+}
+
+#endif
+
+/**
+ * @brief Kernel finding the neighbours of a point among the candidates, with
+ * their coordinates padded with infinity to a multiple of 8.
+ */
+using NearestKernel = void (*)(const float *xs, const float *ys, size_t count,
+                               float x, float y, Neighbours &neighbours);
+
+NearestKernel nearest_kernel() {
+  static const NearestKernel kernel = [] {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+      return nearest_avx2;
+    }
+#endif
+    return nearest_scalar;
+  }();
+  return kernel;
+}
+
+void HeatmapRenderer::render_months(const Stations &stations,
+                                    const MonthlyStatsTable &stats) {
+  constexpr size_t MONTH_COUNT = MONTHS.size();
+  // a band is a row of tiles
+  constexpr size_t BANDS = (RASTER_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+  // a point right at a station takes its value, without dividing by zero
+  constexpr float MIN_SQUARED_DISTANCE = 1e-6f;
+  constexpr float FAR_AWAY = std::numeric_limits<float>::infinity();
+
+  mMinmax = minmax_station_averages(stats);
+  project_stations(stations);
+  const ColorScale color_index(mMinmax);
+  const auto nearest = nearest_kernel();
+
+  std::vector<float> xs;
+  std::vector<float> ys;
+  for (const auto &position : mPositions) {
+    xs.push_back(position.x);
+    ys.push_back(position.y);
+  }
+  const spatial::PointGrid grid(xs, ys);
+
+  // The averages of each station for all months next to each other, so a
+  // neighbour adds to all of them at once, 0 for the months without
+  // measurements, with 1 for the months with them.
+  const size_t count = stations.size();
+  std::vector<float> values(count * MONTH_COUNT, 0.f);
+  std::vector<float> present(count * MONTH_COUNT, 0.f);
+  for (size_t i = 0; i < count; i++) {
+    for (size_t month = 0; month < MONTH_COUNT; month++) {
+      const auto average = month_average(stats[i], month);
+      if (!std::isnan(average)) {
+        values[i * MONTH_COUNT + month] = static_cast<float>(average);
+        present[i * MONTH_COUNT + month] = 1.f;
+      }
+    }
+  }
+
+  std::vector<std::string> encoded(MONTH_COUNT * BANDS);
+
+  const threadpool::Partitioning partitioning{
+      .schedule = threadpool::Schedule::Dynamic,
+      .grain = 1,
+      .max_threads = mThreads};
+
+  threadpool::pool.parallel_for(
+      BANDS,
+      [&](const size_t band) {
+        const size_t top = band * TILE_SIZE;
+        const size_t rows = std::min(TILE_SIZE, RASTER_HEIGHT - top);
+
+        std::vector<raster::Image> images(MONTH_COUNT,
+                                          raster::Image(RASTER_WIDTH, rows));
+
+        std::vector<uint32_t> candidates;
+        std::vector<float> candidate_xs;
+        std::vector<float> candidate_ys;
+        Neighbours neighbours;
+
+        for (size_t left = 0; left < RASTER_WIDTH; left += TILE_SIZE) {
+          const size_t columns = std::min(TILE_SIZE, RASTER_WIDTH - left);
+          const float center_x = left + columns / 2.f;
+          const float center_y = top + rows / 2.f;
+
+          // The nearest stations of any pixel of the tile are at most the
+          // distance of the furthest neighbours of the center plus twice
+          // the distance from the center to a corner away from the center.
+          const float half_diagonal = std::hypot(columns, rows) / 2.f;
+          const float radius =
+              std::sqrt(grid.kth_nearest_distance(center_x, center_y,
+                                                  NEIGHBOURS)) +
+              2 * half_diagonal;
+
+          candidates.clear();
+          grid.within(center_x, center_y, radius, candidates);
+          // by the order of the stations, so the result doesn't depend on
+          // the order of the grid
+          std::ranges::sort(candidates);
+
+          candidate_xs.clear();
+          candidate_ys.clear();
+          for (const auto i : candidates) {
+            candidate_xs.push_back(xs[i]);
+            candidate_ys.push_back(ys[i]);
+          }
+          while (candidate_xs.size() % 8 != 0) {
+            candidate_xs.push_back(FAR_AWAY);
+            candidate_ys.push_back(FAR_AWAY);
+          }
+
+          for (size_t y = 0; y < rows; y++) {
+            for (size_t x = left; x < left + columns; x++) {
+              neighbours.clear();
+              // at the centers of the pixels
+              nearest(candidate_xs.data(), candidate_ys.data(),
+                      candidates.size(), x + 0.5f, top + y + 0.5f,
+                      neighbours);
+
+              // the neighbours without measurements in a month get no weight
+              // in it
+              std::array<float, MONTH_COUNT> weighted{};
+              std::array<float, MONTH_COUNT> totals{};
+              for (size_t i = 0; i < NEIGHBOURS; i++) {
+                const float distance = neighbours.distances[i];
+                if (!std::isfinite(distance)) {
+                  break;
+                }
+
+                const float weight =
+                    1 / std::max(distance, MIN_SQUARED_DISTANCE);
+                const size_t station = candidates[neighbours.candidates[i]];
+                const float *station_values = &values[station * MONTH_COUNT];
+                const float *station_present =
+                    &present[station * MONTH_COUNT];
+                for (size_t month = 0; month < MONTH_COUNT; month++) {
+                  weighted[month] += weight * station_values[month];
+                  totals[month] += weight * station_present[month];
+                }
+              }
+
+              for (size_t month = 0; month < MONTH_COUNT; month++) {
+                images[month].row(y)[x] =
+                    totals[month] > 0
+                        ? color_index(weighted[month] / totals[month])
+                        : NO_DATA_INDEX;
+              }
+            }
+          }
+        }
+
+        for (size_t month = 0; month < MONTH_COUNT; month++) {
+          encoded[month * BANDS + band] =
+              raster::encode_rle8(images[month], 0, rows);
+        }
+      },
+      partitioning);
+
+  write_bitmaps(encoded, BANDS, partitioning);
+}
+
+RendererKind parse_renderer(const std::string_view name) {
+  if (name == "svg") {
+    return RendererKind::Svg;
+  } else if (name == "bmp") {
+    return RendererKind::Bitmap;
+  } else if (name == "heatmap") {
+    return RendererKind::Heatmap;
+  }
+  throw std::invalid_argument(std::format(
+      "Unknown renderer '{}', expected one of svg, bmp, heatmap.", name));
+}
+
+std::string_view renderer_name(const RendererKind kind) {
+  switch (kind) {
+  case RendererKind::Svg:
+    return "svg";
+  case RendererKind::Bitmap:
+    return "bmp";
+  case RendererKind::Heatmap:
+    return "heatmap";
+  }
+  return "unknown";
 }
@@ -2,34 +2,72 @@
 
 #include "colors.hpp"
 #include "data.hpp"
+#include "raster.hpp"
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
 
 constexpr float MAP_WIDTH = 1412.f;
 constexpr float MAP_HEIGHT = 809.f;
 
+// size of the raster maps, a pixel per unit of the SVG ones
+constexpr size_t RASTER_WIDTH = static_cast<size_t>(MAP_WIDTH);
+constexpr size_t RASTER_HEIGHT = static_cast<size_t>(MAP_HEIGHT);
+
+/**
+ * @brief Position of a station on the map.
+ */
+struct MapPosition {
+  float x;
+  float y;
+};
+
 class Renderer {
 public:
   Renderer();
   virtual ~Renderer() = default;
 
-  std::string render_station(const Station &station,
-                             const Temperature temperature) const;
+  /**
+   * @brief Appends the circle of a station, colored by the temperature, to
+   * the buffer.
+   */
+  void render_station(std::string &buffer, const MapPosition &position,
+                      const Temperature temperature) const;
 
-  void render_month_to_file(const Stations &stations,
-                            const std::vector<StationMonthlyStats> &stats,
+  /**
+   * @brief Renders the map of the month into a buffer reused by the thread,
+   * and writes it between the shared header and footer with a single
+   * `writev`.
+   *
+   * A file that cannot be written is reported to `std::cerr` and the other
+   * months are still rendered.
+   */
+  void render_month_to_file(const MonthlyStatsTable &stats,
                             const size_t month,
                             const std::string &file_name) const;
 
   virtual void render_months(const Stations &stations,
-                             const std::vector<StationMonthlyStats> &stats) = 0;
+                             const MonthlyStatsTable &stats) = 0;
 
 protected:
+  /**
+   * @brief Projects the locations of the stations onto the map, once for all
+   * the months.
+   */
+  void project_stations(const Stations &stations);
+
   std::ranges::minmax_result<Temperature> mMinmax;
+  std::vector<MapPosition> mPositions;
   static std::string HEADER;
 
   static constexpr std::string_view TEMPLATE =
       "<circle cy=\"{}\" cx=\"{}\" r=\"10\" fill=\"rgb({},{},{})\" />\n";
+  // longer than any circle, the numbers take at most 15 characters each
+  static constexpr size_t MAX_CIRCLE_SIZE = 128;
   static constexpr std::string_view FOOTER = "</svg>";
 
   static constexpr std::pair<double, double> UPPER_LEFT_CORNER{
@@ -41,11 +79,127 @@ protected:
 class SerialRenderer final : public Renderer {
 public:
   void render_months(const Stations &stations,
-                     const std::vector<StationMonthlyStats> &stats) override;
+                     const MonthlyStatsTable &stats) override;
 };
 
 class ParallelRenderer final : public Renderer {
 public:
+  // threads: maximum number of threads to use, 0 for the whole pool
+  explicit ParallelRenderer(size_t threads = 0) : mThreads(threads) {}
+
+  void render_months(const Stations &stations,
+                     const MonthlyStatsTable &stats) override;
+
+private:
+  size_t mThreads;
+};
+
+/**
+ * Renders the maps into BMP images instead of SVG: a heat field interpolated
+ * from the averages of the stations, with the stations as dots over it.
+ *
+ * The field is sampled at the corners of `TILE_SIZE` tiles by inverse
+ * distance weighting over all stations, and bilinearly interpolated in
+ * between. The samples and then the pixels are computed by rows of all 12
+ * months at once on the threadpool, and each image is then encoded and
+ * written by a task of its own.
+ */
+class RasterRenderer : public Renderer {
+public:
+  void render_months(const Stations &stations,
+                     const MonthlyStatsTable &stats) override;
+
+protected:
+  // threads: maximum number of threads to use, 1 for the calling one only, 0
+  // for the whole pool
+  explicit RasterRenderer(size_t threads) : mThreads(threads) {}
+
+private:
+  static constexpr size_t TILE_SIZE = 16;
+  // rows of pixels rendered by a task
+  static constexpr size_t BAND_HEIGHT = 32;
+  // same as the circles of the SVG maps
+  static constexpr float DOT_RADIUS = 10.f;
+  static constexpr float OUTLINE_WIDTH = 1.5f;
+  static constexpr uint8_t OUTLINE_INDEX = 0;
+
+  size_t mThreads;
+};
+
+class SerialRasterRenderer final : public RasterRenderer {
+public:
+  SerialRasterRenderer() : RasterRenderer(1) {}
+};
+
+class ParallelRasterRenderer final : public RasterRenderer {
+public:
+  // threads: maximum number of threads to use, 0 for the whole pool
+  explicit ParallelRasterRenderer(size_t threads = 0)
+      : RasterRenderer(threads) {}
+};
+
+/**
+ * Renders the maps into BMP images of a continuous temperature field instead
+ * of dots: each pixel is the inverse distance weighted average of its
+ * `NEIGHBOURS` nearest stations.
+ *
+ * Looking for the nearest stations of each pixel among all of them would be
+ * O(pixels × stations). Instead, each tile of pixels takes only the stations
+ * that can be among the nearest of any of its pixels from a
+ * `spatial::PointGrid`, and its pixels compare the distances to those 8 at a
+ * time with AVX2. The neighbours and weights of a band of pixels are found
+ * once for all 12 months, and the bands are rendered in parallel.
+ */
+class HeatmapRenderer : public Renderer {
+public:
+  static constexpr size_t NEIGHBOURS = 8;
+
   void render_months(const Stations &stations,
-                     const std::vector<StationMonthlyStats> &stats) override;
+                     const MonthlyStatsTable &stats) override;
+
+protected:
+  // threads: maximum number of threads to use, 1 for the calling one only, 0
+  // for the whole pool
+  explicit HeatmapRenderer(size_t threads) : mThreads(threads) {}
+
+private:
+  // also the height of the bands rendered by a task
+  static constexpr size_t TILE_SIZE = 16;
+  // the outline color of the palette, for the pixels without any neighbours
+  static constexpr uint8_t NO_DATA_INDEX = 0;
+
+  size_t mThreads;
+};
+
+class SerialHeatmapRenderer final : public HeatmapRenderer {
+public:
+  SerialHeatmapRenderer() : HeatmapRenderer(1) {}
+};
+
+class ParallelHeatmapRenderer final : public HeatmapRenderer {
+public:
+  // threads: maximum number of threads to use, 0 for the whole pool
+  explicit ParallelHeatmapRenderer(size_t threads = 0)
+      : HeatmapRenderer(threads) {}
+};
+
+enum class RendererKind { Svg, Bitmap, Heatmap };
+
+/**
+ * @brief Parses a renderer name: `svg`, `bmp` or `heatmap`.
+ *
+ * @throws std::invalid_argument if the name is unknown.
+ */
+RendererKind parse_renderer(std::string_view name);
+
+std::string_view renderer_name(RendererKind kind);
+
+template <> struct std::formatter<RendererKind> {
+  constexpr auto parse(std::format_parse_context const &ctx) const {
+    return ctx.begin();
+  }
+  template <typename FormatContext>
+  auto format(const RendererKind &kind, FormatContext &ctx) const {
+    return std::format_to(ctx.out(), "{}", renderer_name(kind));
+  }
 };
@@ -0,0 +1,398 @@
+#pragma once
+
+#include "data.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Tokenizer for the measurements file.
+ *
+ * Works in two stages similar to simdjson: first a SIMD scan finds the
+ * positions of all structural characters (`;` and `\n`) in 64-byte blocks,
+ * then the records are parsed using the fact that every line has exactly the
+ * same layout (`id;ordinal;year;month;day;value`), so the field boundaries are
+ * known without looking at the bytes again.
+ *
+ * The instruction set is chosen at compile time (AVX2, SSE4.2 or a portable
+ * scalar fallback), which fits the `-march=native` release build.
+ */
+namespace scanner {
+
+static_assert(std::endian::native == std::endian::little,
+              "The SWAR digit parsing assumes a little-endian machine");
+
+/**
+ * @brief Converts a string to a number.
+ *
+ * Simpler and faster version of stoul optimized for raw speed with no error
+ * or bounds checking.
+ */
+inline size_t str_to_number(auto str) {
+  size_t result = 0;
+  // disable loop unrolling, since the numbers are usually only a few digits
+  // long
+#pragma clang loop unroll(disable)
+  for (const char c : str) {
+    result *= 10;
+    result += c - '0';
+  }
+  return result;
+}
+
+/**
+ * @brief Converts a string to a double.
+ *
+ * Simpler and faster version of stod optimized for raw speed with no error
+ * or bounds checking.
+ */
+inline double str_to_double(auto str) {
+  const char *ptr = str.data();
+  const char *end = str.data() + str.size();
+
+  bool has_signum = str[0] == '-';
+  ptr += has_signum;
+
+  int_fast64_t acc = 0;
+
+#pragma clang loop unroll(disable)
+  while (ptr < end && *ptr != '.') {
+    acc *= 10;
+    acc += *ptr - '0';
+    ptr++;
+  }
+
+  double whole = has_signum ? -acc : acc;
+
+  if (ptr == end) [[unlikely]] {
+    return whole;
+  }
+
+  // skip the decimal point
+  ptr++;
+
+  uint_fast32_t decimals = 0;
+  uint_fast32_t power = 1;
+
+#pragma clang loop unroll(disable)
+  while (ptr < end) {
+    decimals *= 10;
+    decimals += *ptr++ - '0';
+    power *= 10;
+  }
+
+  double fractional = static_cast<double>(decimals) / power;
+  double result = whole + (has_signum ? -fractional : fractional);
+
+  return result;
+}
+
+/**
+ * @brief Bitmask of the structural characters in a 64-byte block.
+ *
+ * Bit `i` is set when `block[i]` is either `;` or `\n`.
+ */
+inline uint64_t structural_mask(const char *block) {
+#if defined(__AVX2__)
+  const __m256i separator = _mm256_set1_epi8(';');
+  const __m256i newline = _mm256_set1_epi8('\n');
+
+  const auto half_mask = [&](const char *half) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(half));
+    const __m256i matches =
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, separator),
+                        _mm256_cmpeq_epi8(bytes, newline));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+  };
+
+  return half_mask(block) | static_cast<uint64_t>(half_mask(block + 32)) << 32;
+#elif defined(__SSE4_2__)
+  const __m128i structural = _mm_setr_epi8(';', '\n', 0, 0, 0, 0, 0, 0, 0, 0,
+                                           0, 0, 0, 0, 0, 0);
+
+  uint64_t mask = 0;
+  for (size_t i = 0; i < 4; i++) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+    // explicit lengths, so NUL bytes in the padded tail are handled too
+    const __m128i matches =
+        _mm_cmpestrm(structural, 2, bytes, 16,
+                     _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+    mask |= static_cast<uint64_t>(_mm_cvtsi128_si32(matches) & 0xFFFF)
+            << (i * 16);
+  }
+  return mask;
+#else
+  uint64_t mask = 0;
+  for (size_t i = 0; i < 64; i++) {
+    mask |= static_cast<uint64_t>(block[i] == ';' || block[i] == '\n') << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * @brief Number of newlines in `data`.
+ */
+inline size_t count_newlines(const std::string_view data) {
+  size_t count = 0;
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i newline = _mm256_set1_epi8('\n');
+  for (; i + 32 <= data.size(); i += 32) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data.data() + i));
+    count += std::popcount(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline))));
+  }
+#elif defined(__SSE4_2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= data.size(); i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data.data() + i));
+    count += std::popcount(static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline))));
+  }
+#endif
+
+  for (; i < data.size(); i++) {
+    count += data[i] == '\n';
+  }
+  return count;
+}
+
+/**
+ * @brief Finds the offsets of all structural characters in `data`.
+ *
+ * @param data The data to scan, at most 4 GiB long.
+ * @param positions Reused output buffer, only grown when too small.
+ *
+ * @return The number of offsets written to the beginning of `positions`.
+ */
+inline size_t scan(std::string_view data, std::vector<uint32_t> &positions) {
+  // every byte may be structural in the worst case
+  if (positions.size() < data.size() + 64) {
+    positions.resize(data.size() + 64);
+  }
+  uint32_t *out = positions.data();
+
+  // Writes the offsets in groups of four regardless of how many there are
+  // left, which makes the loop branch predictable. The garbage after the last
+  // offset is overwritten by the next block (or ignored) thanks to the slack
+  // at the end of the buffer.
+  const auto emit = [&out](uint64_t mask, const uint32_t base) {
+    uint32_t *next = out + std::popcount(mask);
+    while (mask != 0) {
+      for (size_t i = 0; i < 4; i++) {
+        out[i] = base + std::countr_zero(mask);
+        mask &= mask - 1;
+      }
+      out += 4;
+    }
+    out = next;
+  };
+
+  size_t i = 0;
+  for (; i + 64 <= data.size(); i += 64) {
+    emit(structural_mask(data.data() + i), i);
+  }
+
+  if (i < data.size()) {
+    // zero-padded copy of the tail, so the loads stay in bounds
+    std::array<char, 64> tail{};
+    std::memcpy(tail.data(), data.data() + i, data.size() - i);
+    emit(structural_mask(tail.data()), i);
+  }
+
+  return out - positions.data();
+}
+
+/**
+ * @brief Parses up to 8 ASCII digits at once (SWAR).
+ *
+ * Reads 8 bytes starting at `ptr` regardless of `len`, so the caller has to
+ * make sure they are all readable.
+ */
+inline uint64_t parse_digits(const char *ptr, const size_t len) {
+  uint64_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+
+  // The bytes after the field may borrow, but only into even higher bytes,
+  // which are then shifted out. Shifting the digits to the top pads them with
+  // leading zeros.
+  value -= 0x3030303030303030;
+  value = len == 0 ? 0 : value << ((8 - len) * 8);
+
+  value = value * 10 + (value >> 8);
+  value = (((value & 0x000000FF000000FF) * 0x000F424000000064) +
+           (((value >> 16) & 0x000000FF000000FF) * 0x0000271000000001)) >>
+          32;
+
+  return value;
+}
+
+/**
+ * @brief Parses a decimal number of the form `-?\d+(\.\d+)?`.
+ *
+ * Like `parse_digits`, reads past the end of the number, up to 24 bytes from
+ * `ptr` in total. Gives the same result as `str_to_double`.
+ */
+inline Temperature parse_value(const char *ptr, size_t len) {
+  constexpr std::array<double, 9> POWERS_OF_TEN = {
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+  const bool negative = *ptr == '-';
+  ptr += negative;
+  len -= negative;
+
+  uint64_t bytes;
+  std::memcpy(&bytes, ptr, sizeof(bytes));
+
+  // find the first '.' as the first zero byte of `bytes ^ "........"`
+  const uint64_t dots = bytes ^ 0x2E2E2E2E2E2E2E2E;
+  const uint64_t zero_bytes =
+      (dots - 0x0101010101010101) & ~dots & 0x8080808080808080;
+  const size_t dot = std::min<size_t>(std::countr_zero(zero_bytes) / 8, len);
+
+  const size_t decimals = len - std::min(dot + 1, len);
+
+  const auto whole = static_cast<double>(parse_digits(ptr, dot));
+  const auto fractional =
+      static_cast<double>(parse_digits(ptr + dot + 1, decimals)) /
+      POWERS_OF_TEN[decimals];
+
+  return negative ? -(whole + fractional) : whole + fractional;
+}
+
+/**
+ * @brief Number of structural characters on each line.
+ */
+constexpr size_t RECORD_FIELDS = 6;
+
+/**
+ * @brief Parses a single record given the positions of its separators.
+ *
+ * @param data The whole buffer that is being parsed.
+ * @param start Offset of the first byte of the line.
+ * @param separators Offsets of the five `;` on the line.
+ * @param end Offset one past the last byte of the value (excluding `\r\n`).
+ * @param callback Receives `(id, ordinal, year, month, day, value)`.
+ */
+inline void parse_record(std::string_view data, const size_t start,
+                         const uint32_t *separators, const size_t end,
+                         const auto &callback) {
+  const char *base = data.data();
+
+  const size_t value_start = separators[4] + 1;
+
+  // lengths of all six fields, without the separators
+  size_t longest_field = std::max(separators[0] - start, end - value_start);
+  for (size_t i = 1; i < 5; i++) {
+    longest_field = std::max<size_t>(longest_field,
+                                     separators[i] - separators[i - 1] - 1);
+  }
+
+  // The SWAR path reads a bit past each field, which is fine everywhere
+  // except for the last few bytes of the buffer.
+  if (value_start + 24 <= data.size() && longest_field <= 8) [[likely]] {
+    const auto field = [&](const size_t from, const size_t to) {
+      return parse_digits(base + from, to - from);
+    };
+
+    callback(field(start, separators[0]),
+             field(separators[0] + 1, separators[1]),
+             static_cast<Year>(field(separators[1] + 1, separators[2])),
+             static_cast<Month>(field(separators[2] + 1, separators[3])),
+             static_cast<Day>(field(separators[3] + 1, separators[4])),
+             parse_value(base + value_start, end - value_start));
+  } else {
+    const auto field = [&](const size_t from, const size_t to) {
+      return data.substr(from, to - from);
+    };
+
+    callback(str_to_number(field(start, separators[0])),
+             str_to_number(field(separators[0] + 1, separators[1])),
+             static_cast<Year>(
+                 str_to_number(field(separators[1] + 1, separators[2]))),
+             static_cast<Month>(
+                 str_to_number(field(separators[2] + 1, separators[3]))),
+             static_cast<Day>(
+                 str_to_number(field(separators[3] + 1, separators[4]))),
+             str_to_double(field(value_start, end)));
+  }
+}
+
+/**
+ * @brief Parses all records in a block of line-aligned measurements.
+ *
+ * The input is scanned in windows, so the structural positions of one window
+ * stay in the cache while its records are parsed. Empty lines are skipped and
+ * the last line doesn't need to be terminated.
+ *
+ * @param content The measurements, without the header.
+ * @param callback Receives `(id, ordinal, year, month, day, value)` for each
+ * record.
+ */
+inline void for_each_record(std::string_view content, const auto &callback) {
+  constexpr size_t WINDOW = 64 * 1024;
+
+  thread_local std::vector<uint32_t> positions;
+
+  size_t offset = 0;
+  while (offset < content.size()) {
+    const auto data = content.substr(offset);
+    const auto window = data.substr(0, WINDOW);
+    const bool last_window = window.size() == data.size();
+
+    const size_t count = scan(window, positions);
+
+    size_t line_start = 0;
+    size_t i = 0;
+    while (i + RECORD_FIELDS <= count) {
+      const uint32_t *separators = &positions[i];
+
+      // empty line
+      if (window[separators[0]] == '\n') [[unlikely]] {
+        line_start = separators[0] + 1;
+        i++;
+        continue;
+      }
+
+      const size_t newline = separators[RECORD_FIELDS - 1];
+      const size_t end = newline - (window[newline - 1] == '\r');
+
+      parse_record(data, line_start, separators, end, callback);
+
+      line_start = newline + 1;
+      i += RECORD_FIELDS;
+    }
+
+    if (last_window) {
+      // unterminated last line
+      if (count - i == RECORD_FIELDS - 1) {
+        const size_t end = window.size() - window.ends_with('\r');
+        parse_record(data, line_start, &positions[i], end, callback);
+      }
+      return;
+    }
+
+    if (line_start == 0) [[unlikely]] {
+      throw std::runtime_error("Measurement line is too long.");
+    }
+
+    offset += line_start;
+  }
+}
+
+} // namespace scanner
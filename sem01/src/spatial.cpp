@@ -0,0 +1,181 @@
+#include "spatial.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace spatial {
+
+PointGrid::PointGrid(const std::span<const float> xs,
+                     const std::span<const float> ys) {
+  // points per cell on average
+  constexpr float DENSITY = 2;
+
+  const size_t count = xs.size();
+  if (count == 0) {
+    mCellStarts.assign(2, 0);
+    return;
+  }
+
+  const auto [left, right] = std::ranges::minmax(xs);
+  const auto [top, bottom] = std::ranges::minmax(ys);
+  const float width = std::max(right - left, 1.f);
+  const float height = std::max(bottom - top, 1.f);
+
+  mLeft = left;
+  mTop = top;
+  mCellSize = std::sqrt(width * height * DENSITY / count);
+  mColumns = static_cast<size_t>(width / mCellSize) + 1;
+  mRows = static_cast<size_t>(height / mCellSize) + 1;
+
+  // counting sort of the points by their cells
+  std::vector<size_t> cells(count);
+  mCellStarts.assign(mColumns * mRows + 1, 0);
+  for (size_t i = 0; i < count; i++) {
+    const auto [column, row] = cell(xs[i], ys[i]);
+    cells[i] = row * mColumns + column;
+    mCellStarts[cells[i] + 1]++;
+  }
+  for (size_t i = 1; i < mCellStarts.size(); i++) {
+    mCellStarts[i] += mCellStarts[i - 1];
+  }
+
+  mXs.resize(count);
+  mYs.resize(count);
+  mIndices.resize(count);
+  std::vector<uint32_t> next(mCellStarts.begin(), mCellStarts.end() - 1);
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t position = next[cells[i]]++;
+    mXs[position] = xs[i];
+    mYs[position] = ys[i];
+    mIndices[position] = static_cast<uint32_t>(i);
+  }
+}
+
+std::pair<size_t, size_t> PointGrid::cell(const float x, const float y) const {
+  const auto index = [this](const float offset, const size_t cells) {
+    // clamped as a float first, so even an infinite offset can't overflow
+    const float cell = std::clamp(offset / mCellSize, 0.f,
+                                  static_cast<float>(cells - 1));
+    return static_cast<size_t>(cell);
+  };
+  return {index(x - mLeft, mColumns), index(y - mTop, mRows)};
+}
+
+template <typename Visit>
+void PointGrid::visit_cells(const size_t first_column, const size_t last_column,
+                            const size_t first_row, const size_t last_row,
+                            Visit &&visit) const {
+  for (size_t row = first_row; row <= last_row; row++) {
+    for (size_t column = first_column; column <= last_column; column++) {
+      const size_t cell = row * mColumns + column;
+      for (size_t i = mCellStarts[cell]; i < mCellStarts[cell + 1]; i++) {
+        visit(column, row, i);
+      }
+    }
+  }
+}
+
+float PointGrid::kth_nearest_distance(const float x, const float y,
+                                      const size_t k) const {
+  constexpr float INFINITE = std::numeric_limits<float>::infinity();
+
+  if (k == 0) {
+    return 0;
+  }
+  if (k > size()) {
+    return INFINITE;
+  }
+
+  // the k smallest squared distances so far, as a max-heap
+  std::vector<float> nearest;
+  nearest.reserve(k);
+
+  const auto [column, row] = cell(x, y);
+
+  // rings of cells around the one of the point, until no cell further out
+  // can have a point nearer than the k-th one
+  for (size_t ring = 0;; ring++) {
+    const size_t first_column = column - std::min(column, ring);
+    const size_t last_column = std::min(column + ring, mColumns - 1);
+    const size_t first_row = row - std::min(row, ring);
+    const size_t last_row = std::min(row + ring, mRows - 1);
+
+    visit_cells(first_column, last_column, first_row, last_row,
+                [&](const size_t cell_column, const size_t cell_row,
+                    const size_t i) {
+                  // the inner cells were visited by the previous rings
+                  const size_t distance =
+                      std::max(cell_column > column ? cell_column - column
+                                                    : column - cell_column,
+                               cell_row > row ? cell_row - row
+                                              : row - cell_row);
+                  if (distance != ring) {
+                    return;
+                  }
+
+                  const float dx = mXs[i] - x;
+                  const float dy = mYs[i] - y;
+                  const float squared_distance = dx * dx + dy * dy;
+
+                  if (nearest.size() < k) {
+                    nearest.push_back(squared_distance);
+                    std::ranges::push_heap(nearest);
+                  } else if (squared_distance < nearest.front()) {
+                    std::ranges::pop_heap(nearest);
+                    nearest.back() = squared_distance;
+                    std::ranges::push_heap(nearest);
+                  }
+                });
+
+    const bool whole_grid = first_column == 0 && first_row == 0 &&
+                            last_column == mColumns - 1 &&
+                            last_row == mRows - 1;
+    if (nearest.size() < k) {
+      continue;
+    }
+    if (whole_grid) {
+      return nearest.front();
+    }
+
+    // distance to the nearest side of the visited cells with more cells
+    // behind it
+    float bound = INFINITE;
+    if (first_column > 0) {
+      bound = std::min(bound, x - (mLeft + first_column * mCellSize));
+    }
+    if (last_column + 1 < mColumns) {
+      bound = std::min(bound, mLeft + (last_column + 1) * mCellSize - x);
+    }
+    if (first_row > 0) {
+      bound = std::min(bound, y - (mTop + first_row * mCellSize));
+    }
+    if (last_row + 1 < mRows) {
+      bound = std::min(bound, mTop + (last_row + 1) * mCellSize - y);
+    }
+
+    if (nearest.front() <= bound * bound) {
+      return nearest.front();
+    }
+  }
+}
+
+void PointGrid::within(const float x, const float y, const float radius,
+                       std::vector<uint32_t> &indices) const {
+  if (size() == 0) {
+    return;
+  }
+
+  const auto [first_column, first_row] = cell(x - radius, y - radius);
+  const auto [last_column, last_row] = cell(x + radius, y + radius);
+
+  visit_cells(first_column, last_column, first_row, last_row,
+              [&](size_t, size_t, const size_t i) {
+                const float dx = mXs[i] - x;
+                const float dy = mYs[i] - y;
+                if (dx * dx + dy * dy <= radius * radius) {
+                  indices.push_back(mIndices[i]);
+                }
+              });
+}
+
+} // namespace spatial
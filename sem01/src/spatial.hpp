@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * Spatial index of the stations on the map.
+ */
+namespace spatial {
+
+/**
+ * @class PointGrid
+ * @brief Uniform grid of buckets over a set of points, for the nearest
+ * neighbour and radius queries.
+ *
+ * The cells are sized for about two points each, so a query only looks at
+ * the few cells around it instead of all points. The points are stored by
+ * cell, so the points of a cell are contiguous.
+ */
+class PointGrid {
+public:
+  /**
+   * @param xs, ys Coordinates of the points, queries return their indices.
+   */
+  PointGrid(std::span<const float> xs, std::span<const float> ys);
+
+  size_t size() const { return mIndices.size(); }
+
+  /**
+   * @brief Squared distance from the point to its `k`-th nearest point, or
+   * infinity if there are fewer points.
+   */
+  float kth_nearest_distance(float x, float y, size_t k) const;
+
+  /**
+   * @brief Appends the indices of the points within the radius of the point
+   * to `indices`.
+   */
+  void within(float x, float y, float radius,
+              std::vector<uint32_t> &indices) const;
+
+private:
+  /**
+   * @brief Cell of the point, clamped to the grid.
+   */
+  std::pair<size_t, size_t> cell(float x, float y) const;
+
+  template <typename Visit>
+  void visit_cells(size_t first_column, size_t last_column, size_t first_row,
+                   size_t last_row, Visit &&visit) const;
+
+  float mLeft = 0;
+  float mTop = 0;
+  float mCellSize = 1;
+  size_t mColumns = 1;
+  size_t mRows = 1;
+  // points of the cell `i` are `[mCellStarts[i], mCellStarts[i + 1])`
+  std::vector<uint32_t> mCellStarts;
+  std::vector<float> mXs;
+  std::vector<float> mYs;
+  std::vector<uint32_t> mIndices;
+};
+
+} // namespace spatial
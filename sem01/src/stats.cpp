@@ -1,55 +1,355 @@
 #include "stats.hpp"
 #include "threadpool.hpp"
-#include <limits>
-#include <ranges>
+#include <algorithm>
+#include <array>
+#include <bit>
 
-std::pair<StationMonthlyAverages, StationMonthlyMinmaxes>
-calculate_monthly_stats(const Station &station) {
-  StationMonthlyAverages monthly_averages;
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-  StationMonthlyMinmaxes monthly_minmaxes;
-  monthly_minmaxes.fill({std::numeric_limits<Temperature>::infinity(),
-                         -std::numeric_limits<Temperature>::infinity()});
+bool valid_station(const Year first_year, const Year last_year,
+                   const size_t count) {
+  const auto time_span = last_year - first_year;
 
-  Month current_month{station.measurements.front().month};
+  return time_span >= 4 && count / time_span >= 300;
+}
+
+/**
+ * @brief Allocates the stats of the stations, with the range of the years of
+ * each from its first and last measurement (they're ordered by date).
+ */
+MonthlyStatsTable allocate_stats(const Stations &stations) {
+  std::vector<std::pair<Year, Year>> year_ranges(stations.size(), {0, -1});
+  for (size_t i = 0; i < stations.size(); i++) {
+    const auto &years = stations[i].measurements.years;
+    if (!years.empty()) {
+      year_ranges[i] = {years.front(), years.back()};
+    }
+  }
+  return MonthlyStatsTable(year_ranges);
+}
+
+/**
+ * @brief Stores the average of one month of one year.
+ */
+inline void add_month_average(StationMonthlyStats &stats, const Year year,
+                              const Month month, const Temperature average) {
+  // only possible if the measurements aren't ordered by date
+  if (year < stats.first_year ||
+      static_cast<size_t>(year - stats.first_year) >= stats.years) {
+    return;
+  }
+
+  auto &min_max = stats.minmaxes[month - 1];
+  min_max.min = std::min(min_max.min, average);
+  min_max.max = std::max(min_max.max, average);
+
+  stats.average(year, month) = average;
+}
+
+/**
+ * @brief Calculates the monthly stats of a station and checks whether it's
+ * valid, in a single pass over its measurements.
+ *
+ * The measurements are ordered by date, so each month of each year is a
+ * single run of them.
+ *
+ * @return Whether the station is valid.
+ */
+bool calculate_monthly_stats_scalar(const Station &station,
+                                    StationMonthlyStats &stats) {
+  stats.clear();
+
+  const auto &years = station.measurements.years;
+  const auto &months = station.measurements.months;
+  const auto &values = station.measurements.values;
+
+  if (values.empty()) {
+    return false;
+  }
+
+  Year first_year = years.front();
+  Year last_year = years.front();
+
+  Year current_year = years.front();
+  Month current_month = months.front();
   size_t days = 0;
   Temperature running_total{0};
 
-  for (const auto &measurement : station.measurements) {
-    const auto &month = measurement.month;
+  const auto finish_month = [&] {
+    add_month_average(stats, current_year, current_month,
+                      running_total / days);
+  };
 
-    if (month != current_month) {
-      const auto average = running_total / days;
+  for (size_t i = 0; i < values.size(); i++) {
+    const auto year = years[i];
+    const auto month = months[i];
 
-      auto &current_min_max = monthly_minmaxes[month - 1];
-      current_min_max.min = std::min(current_min_max.min, average);
-      current_min_max.max = std::max(current_min_max.max, average);
+    first_year = std::min(first_year, year);
+    last_year = std::max(last_year, year);
 
-      monthly_averages[month - 1].push_back({measurement.year, average});
+    if (month != current_month || year != current_year) {
+      finish_month();
 
+      current_year = year;
       current_month = month;
       days = 0;
       running_total = 0;
     }
 
-    running_total += measurement.value;
+    running_total += values[i];
     days++;
   }
 
-  return {monthly_averages, monthly_minmaxes};
+  finish_month();
+
+  return valid_station(first_year, last_year, values.size());
+}
+
+/**
+ * @brief A run of measurements of the same month of the same year.
+ */
+struct MonthRun {
+  size_t begin;
+  size_t end;
+};
+
+/**
+ * @brief End of the run starting at `begin`, checking from `from` on.
+ */
+inline size_t scan_run(const Year *years, const Month *months,
+                       const size_t begin, size_t from, const size_t size) {
+  while (from < size && years[from] == years[begin] &&
+         months[from] == months[begin]) {
+    from++;
+  }
+  return from;
+}
+
+size_t run_end_scalar(const Year *years, const Month *months,
+                      const size_t begin, const size_t size) {
+  return scan_run(years, months, begin, begin + 1, size);
+}
+
+void sum_runs_scalar(const Temperature *values, const MonthRun *runs,
+                     const size_t count, Temperature *sums) {
+  // four runs at once, so their additions overlap in the pipeline, while
+  // each of them is still added up in order
+  size_t run = 0;
+  for (; run + 4 <= count; run += 4) {
+    std::array<Temperature, 4> totals{};
+    size_t longest = 0;
+    for (size_t lane = 0; lane < 4; lane++) {
+      const auto &[begin, end] = runs[run + lane];
+      longest = std::max(longest, end - begin);
+    }
+
+    for (size_t i = 0; i < longest; i++) {
+      for (size_t lane = 0; lane < 4; lane++) {
+        const auto &[begin, end] = runs[run + lane];
+        if (begin + i < end) {
+          totals[lane] += values[begin + i];
+        }
+      }
+    }
+
+    std::ranges::copy(totals, sums + run);
+  }
+
+  for (; run < count; run++) {
+    Temperature total{0};
+    for (size_t i = runs[run].begin; i < runs[run].end; i++) {
+      total += values[i];
+    }
+    sums[run] = total;
+  }
 }
 
-std::vector<StationMonthlyStats>
-SerialStats::monthly_stats(const Stations &stations) const {
-  return stations | std::views::transform(calculate_monthly_stats) |
-         std::ranges::to<std::vector>();
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) size_t
+run_end_avx2(const Year *years, const Month *months, const size_t begin,
+             const size_t size) {
+  const __m256i year = _mm256_set1_epi16(years[begin]);
+  const __m256i month = _mm256_set1_epi16(months[begin]);
+
+  size_t i = begin + 1;
+  for (; i + 16 <= size; i += 16) {
+    const __m256i same = _mm256_and_si256(
+        _mm256_cmpeq_epi16(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(years + i)),
+            year),
+        _mm256_cmpeq_epi16(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(months + i)),
+            month));
+
+    // two mask bits per 16-bit lane
+    const auto different =
+        ~static_cast<uint32_t>(_mm256_movemask_epi8(same));
+    if (different != 0) {
+      return i + std::countr_zero(different) / 2;
+    }
+  }
+
+  return scan_run(years, months, begin, i, size);
 }
 
-std::vector<StationMonthlyStats>
-ParallelStats::monthly_stats(const Stations &stations) const {
-  return threadpool::pool.transform(stations, calculate_monthly_stats) |
-         std::views::transform([](std::future<StationMonthlyStats> &f) mutable {
-           return f.get();
-         }) |
-         std::ranges::to<std::vector>();
+__attribute__((target("avx2"))) void
+sum_runs_avx2(const Temperature *values, const MonthRun *runs,
+              const size_t count, Temperature *sums) {
+  // one run per lane, each still added up in order
+  size_t run = 0;
+  for (; run + 4 <= count; run += 4) {
+    const MonthRun *group = runs + run;
+    std::array<size_t, 4> run_sizes;
+    for (size_t lane = 0; lane < 4; lane++) {
+      run_sizes[lane] = group[lane].end - group[lane].begin;
+    }
+    const size_t longest = std::ranges::max(run_sizes);
+
+    const __m256i begins =
+        _mm256_setr_epi64x(group[0].begin, group[1].begin, group[2].begin,
+                           group[3].begin);
+    const __m256i lengths = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(run_sizes.data()));
+
+    __m256d totals = _mm256_setzero_pd();
+    for (size_t i = 0; i < longest; i++) {
+      const __m256i offset = _mm256_set1_epi64x(i);
+      // finished runs add zero, which leaves their sum unchanged
+      const __m256d active =
+          _mm256_castsi256_pd(_mm256_cmpgt_epi64(lengths, offset));
+      const __m256d next = _mm256_mask_i64gather_pd(
+          _mm256_setzero_pd(), values, _mm256_add_epi64(begins, offset),
+          active, sizeof(Temperature));
+      totals = _mm256_add_pd(totals, next);
+    }
+
+    _mm256_storeu_pd(sums + run, totals);
+  }
+
+  sum_runs_scalar(values, runs + run, count - run, sums + run);
+}
+
+#endif
+
+/**
+ * @brief Kernels of `calculate_monthly_stats_simd` for the instruction sets
+ * of the CPU.
+ */
+struct RunKernels {
+  std::string_view name;
+  // end of the run starting at `begin`
+  size_t (*run_end)(const Year *years, const Month *months, size_t begin,
+                    size_t size);
+  // sum of the values of each run
+  void (*sum_runs)(const Temperature *values, const MonthRun *runs,
+                   size_t count, Temperature *sums);
+};
+
+const RunKernels &run_kernels() {
+  static const RunKernels kernels = [] {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+      return RunKernels{"avx2", run_end_avx2, sum_runs_avx2};
+    }
+#endif
+    return RunKernels{"scalar", run_end_scalar, sum_runs_scalar};
+  }();
+  return kernels;
+}
+
+/**
+ * @brief Same as `calculate_monthly_stats_scalar`, but first finds all runs
+ * of the months and then sums them with the vectorized kernels.
+ */
+bool calculate_monthly_stats_simd(const Station &station,
+                                  StationMonthlyStats &stats) {
+  stats.clear();
+
+  const auto &years = station.measurements.years;
+  const auto &months = station.measurements.months;
+  const auto &values = station.measurements.values;
+
+  if (values.empty()) {
+    return false;
+  }
+
+  const auto &kernels = run_kernels();
+
+  // keep their capacity for the next station processed by the thread
+  thread_local std::vector<MonthRun> runs;
+  thread_local std::vector<Temperature> sums;
+  runs.clear();
+
+  for (size_t begin = 0; begin < values.size();) {
+    const size_t end =
+        kernels.run_end(years.data(), months.data(), begin, values.size());
+    runs.push_back({begin, end});
+    begin = end;
+  }
+
+  sums.resize(runs.size());
+  kernels.sum_runs(values.data(), runs.data(), runs.size(), sums.data());
+
+  Year first_year = years.front();
+  Year last_year = years.front();
+
+  for (size_t i = 0; i < runs.size(); i++) {
+    const auto [begin, end] = runs[i];
+    const auto year = years[begin];
+    const auto month = months[begin];
+
+    first_year = std::min(first_year, year);
+    last_year = std::max(last_year, year);
+
+    add_month_average(stats, year, month, sums[i] / (end - begin));
+  }
+
+  return valid_station(first_year, last_year, values.size());
+}
+
+/**
+ * @brief Calculates the monthly stats of a station with the selected kernels.
+ *
+ * @return Whether the station is valid.
+ */
+bool calculate_monthly_stats(const Station &station,
+                             StationMonthlyStats &stats,
+                             const StatsKernels kernels) {
+  return kernels == StatsKernels::Simd
+             ? calculate_monthly_stats_simd(station, stats)
+             : calculate_monthly_stats_scalar(station, stats);
+}
+
+std::string_view Stats::simd_kernels() { return run_kernels().name; }
+
+MonthlyStatsTable SerialStats::monthly_stats(const Stations &stations,
+                                             std::vector<char> &valid) const {
+  auto stats = allocate_stats(stations);
+  valid.resize(stations.size());
+
+  for (size_t i = 0; i < stations.size(); i++) {
+    valid[i] = calculate_monthly_stats(stations[i], stats[i], mKernels);
+  }
+
+  return stats;
+}
+
+MonthlyStatsTable ParallelStats::monthly_stats(const Stations &stations,
+                                               std::vector<char> &valid) const {
+  auto stats = allocate_stats(stations);
+  valid.resize(stations.size());
+
+  // same partitioning as the allocation of the measurements, so each station
+  // is processed by the worker whose memory it's in
+  threadpool::pool.parallel_for(
+      stations.size(),
+      [&](const size_t i) {
+        valid[i] = calculate_monthly_stats(stations[i], stats[i], mKernels);
+      },
+      threadpool::pool.affine_partitioning(stations.size(), mThreads));
+
+  return stats;
 }
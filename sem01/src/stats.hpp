@@ -1,21 +1,68 @@
+#pragma once
+
 #include "data.hpp"
+#include <string_view>
+
+/**
+ * @brief Whether a station measured for long enough, and often enough.
+ */
+bool valid_station(Year first_year, Year last_year, size_t count);
 
+/**
+ * @brief Implementations of the pass over the measurements of a station.
+ */
+enum class StatsKernels {
+  // Finds the runs of the months and sums them with explicitly vectorized
+  // kernels, chosen at runtime by the instruction sets of the CPU.
+  Simd,
+  // A single plain loop, for comparison.
+  Scalar,
+};
+
+/**
+ * Calculates the monthly stats of each station, and in the same pass over the
+ * measurements whether the station has enough data to be kept (see
+ * `Preprocessor`). The stats of an invalid station are unspecified.
+ *
+ * Both implementations add up each run of the measurements of a month in
+ * order, so the stats are exactly the same with either.
+ */
 class Stats {
 public:
   virtual ~Stats() = default;
 
-  virtual std::vector<StationMonthlyStats>
-  monthly_stats(const Stations &stations) const = 0;
+  virtual MonthlyStatsTable monthly_stats(const Stations &stations,
+                                          std::vector<char> &valid) const = 0;
+
+  /**
+   * @brief Selects the implementation of the pass, the vectorized one by
+   * default.
+   */
+  void set_kernels(const StatsKernels kernels) { mKernels = kernels; }
+
+  /**
+   * @brief Name of the vectorized kernels in use, `avx2` or `scalar`.
+   */
+  static std::string_view simd_kernels();
+
+protected:
+  StatsKernels mKernels = StatsKernels::Simd;
 };
 
 class SerialStats : public Stats {
 public:
-  std::vector<StationMonthlyStats>
-  monthly_stats(const Stations &stations) const override;
+  MonthlyStatsTable monthly_stats(const Stations &stations,
+                                  std::vector<char> &valid) const override;
 };
 
 class ParallelStats : public Stats {
 public:
-  std::vector<StationMonthlyStats>
-  monthly_stats(const Stations &stations) const override;
+  // threads: maximum number of threads to use, 0 for the whole pool
+  explicit ParallelStats(size_t threads = 0) : mThreads(threads) {}
+
+  MonthlyStatsTable monthly_stats(const Stations &stations,
+                                  std::vector<char> &valid) const override;
+
+private:
+  size_t mThreads;
 };
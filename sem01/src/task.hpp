@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace threadpool {
+
+namespace detail {
+
+/**
+ * @class BlockCache
+ * @brief Recycles memory blocks of a fixed size, so the hot paths of the
+ * threadpool don't have to go to the allocator.
+ *
+ * Every thread keeps its own free list. The blocks are usually allocated on
+ * one thread (the spawner) and freed on another (the worker that ran the
+ * task), so a full list spills half of its blocks to a shared list and an
+ * empty one refills from it, both in batches under a single mutex lock.
+ *
+ * @tparam Size Size of the blocks in bytes.
+ * @tparam Alignment Alignment of the blocks.
+ */
+template <size_t Size, size_t Alignment> class BlockCache {
+public:
+  /**
+   * @brief Get a block, from the cache if possible.
+   */
+  static void *allocate() {
+    auto &local = local_blocks();
+
+    if (local.empty()) {
+      refill(local);
+    }
+
+    if (local.empty()) {
+      return ::operator new(Size, std::align_val_t{Alignment});
+    }
+
+    void *block = local.back();
+    local.pop_back();
+    return block;
+  }
+
+  /**
+   * @brief Return a block obtained from `allocate` to the cache.
+   */
+  static void deallocate(void *block) {
+    auto &local = local_blocks();
+
+    if (local.size() == LOCAL_CAPACITY) {
+      spill(local);
+    }
+
+    local.push_back(block);
+  }
+
+private:
+  static constexpr size_t LOCAL_CAPACITY = 256;
+  static constexpr size_t BATCH = LOCAL_CAPACITY / 2;
+
+  struct LocalBlocks : std::vector<void *> {
+    LocalBlocks() { reserve(LOCAL_CAPACITY); }
+
+    ~LocalBlocks() {
+      for (void *block : *this) {
+        ::operator delete(block, std::align_val_t{Alignment});
+      }
+    }
+  };
+
+  struct SharedBlocks {
+    std::mutex mutex;
+    std::vector<void *> blocks;
+  };
+
+  static LocalBlocks &local_blocks() {
+    thread_local LocalBlocks blocks;
+    return blocks;
+  }
+
+  static SharedBlocks &shared_blocks() {
+    // never destroyed, since threads may still exit during static destruction
+    static auto *blocks = new SharedBlocks;
+    return *blocks;
+  }
+
+  static void refill(LocalBlocks &local) {
+    auto &shared = shared_blocks();
+    std::unique_lock<std::mutex> lock(shared.mutex);
+
+    const size_t count = std::min(BATCH, shared.blocks.size());
+    local.insert(local.end(), shared.blocks.end() - count, shared.blocks.end());
+    shared.blocks.resize(shared.blocks.size() - count);
+  }
+
+  static void spill(LocalBlocks &local) {
+    auto &shared = shared_blocks();
+    std::unique_lock<std::mutex> lock(shared.mutex);
+
+    shared.blocks.insert(shared.blocks.end(), local.end() - BATCH, local.end());
+    local.resize(local.size() - BATCH);
+  }
+};
+
+} // namespace detail
+
+/**
+ * @class Task
+ * @brief A move-only type-erased `void()` callable.
+ *
+ * Unlike `std::function`, it doesn't require the callable to be copyable and
+ * stores callables of up to `INLINE_SIZE` bytes inline, so spawning a task
+ * with a small capture doesn't allocate. Larger callables are moved to the
+ * heap. The whole task fits into a single cache line.
+ */
+class Task {
+public:
+  static constexpr size_t INLINE_SIZE = 48;
+
+  Task() = default;
+
+  /**
+   * @brief Construct a task from a callable.
+   */
+  template <typename F>
+    requires(!std::same_as<std::remove_cvref_t<F>, Task> &&
+             std::invocable<std::decay_t<F> &>)
+  Task(F &&f) {
+    using Fn = std::decay_t<F>;
+
+    if constexpr (fits_inline<Fn>) {
+      new (mStorage) Fn(std::forward<F>(f));
+      mOperations = &INLINE_OPERATIONS<Fn>;
+    } else {
+      new (mStorage) Fn *(new Fn(std::forward<F>(f)));
+      mOperations = &HEAP_OPERATIONS<Fn>;
+    }
+  }
+
+  Task(Task &&other) noexcept : mOperations(other.mOperations) {
+    if (mOperations) {
+      mOperations->move(other.mStorage, mStorage);
+      other.mOperations = nullptr;
+    }
+  }
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      reset();
+      mOperations = other.mOperations;
+      if (mOperations) {
+        mOperations->move(other.mStorage, mStorage);
+        other.mOperations = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() { reset(); }
+
+  /**
+   * @brief Run the callable. The task must not be empty.
+   */
+  void operator()() { mOperations->invoke(mStorage); }
+
+  explicit operator bool() const { return mOperations != nullptr; }
+
+private:
+  struct Operations {
+    void (*invoke)(void *storage);
+    // move-constructs into `to` and destroys `from`
+    void (*move)(void *from, void *to);
+    void (*destroy)(void *storage);
+  };
+
+  template <typename Fn>
+  static constexpr bool fits_inline =
+      sizeof(Fn) <= INLINE_SIZE &&
+      alignof(Fn) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible_v<Fn>;
+
+  template <typename Fn>
+  static constexpr Operations INLINE_OPERATIONS = {
+      [](void *storage) { (*static_cast<Fn *>(storage))(); },
+      [](void *from, void *to) {
+        new (to) Fn(std::move(*static_cast<Fn *>(from)));
+        static_cast<Fn *>(from)->~Fn();
+      },
+      [](void *storage) { static_cast<Fn *>(storage)->~Fn(); },
+  };
+
+  template <typename Fn>
+  static constexpr Operations HEAP_OPERATIONS = {
+      [](void *storage) { (**static_cast<Fn **>(storage))(); },
+      [](void *from, void *to) { new (to) Fn *(*static_cast<Fn **>(from)); },
+      [](void *storage) { delete *static_cast<Fn **>(storage); },
+  };
+
+  void reset() {
+    if (mOperations) {
+      mOperations->destroy(mStorage);
+      mOperations = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) std::byte mStorage[INLINE_SIZE];
+  const Operations *mOperations = nullptr;
+};
+
+} // namespace threadpool
@@ -1,43 +1,313 @@
 #include "threadpool.hpp"
 #include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
 
 namespace threadpool {
 
-Threadpool::Threadpool(size_t thread_count) {
+// the deques hold pointers, so the tasks themselves are recycled too
+using TaskCache = detail::BlockCache<sizeof(Task), alignof(Task)>;
+
+// pool and index of the worker running on the current thread, if any
+static thread_local const Threadpool *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+Threadpool::Threadpool(size_t thread_count) { start(thread_count); }
+
+void Threadpool::start(const size_t thread_count) {
   mWorkers.reserve(thread_count);
 
+  // all deques have to exist before any worker starts stealing
   for (std::size_t i = 0; i < thread_count; ++i) {
-    mWorkers.emplace_back([this] {
-      std::function<void()> task;
-      while (true) {
-        std::unique_lock<std::mutex> lock(mMutex);
-        mCondition.wait(lock,
-                        // shutting down or task available
-                        [&] { return !mRunning || !mTasks.empty(); });
+    mWorkers.push_back(std::make_unique<Worker>());
+  }
 
-        if (!mRunning && mTasks.empty())
-          return;
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    mWorkers[i]->thread = std::jthread([this, i] { run_worker(i); });
+  }
+}
 
-        task = std::move(mTasks.front());
-        mTasks.pop();
+void Threadpool::run_worker(const size_t index) {
+  current_pool = this;
+  current_worker = index;
 
-        lock.unlock();
+  std::minstd_rand random(index + 1);
 
-        task();
-      }
-    });
+  while (true) {
+    // read before looking for work, so a spawn in between isn't missed
+    const auto epoch = mEpoch.load();
+
+    if (Task *task = find_task(index, random)) {
+      run_task(task, index);
+      continue;
+    }
+
+    // shutting down, but other workers may still spawn new tasks, so wait
+    // for them (or for the last one to finish) like for any other
+    if (!mRunning.load() && mPending.load() == 0) {
+      return;
+    }
+
+    mSleeping.fetch_add(1);
+    mEpoch.wait(epoch);
+    mSleeping.fetch_sub(1);
+  }
+}
+
+Task *Threadpool::find_task(const size_t index, std::minstd_rand &random) {
+  if (index != NOT_A_WORKER) {
+    if (Task *task = mWorkers[index]->deque.pop()) {
+      return task;
+    }
+  }
+
+  if (mInjectorSize.load() > 0) {
+    std::unique_lock<std::mutex> lock(mInjectorMutex);
+    if (!mInjector.empty()) {
+      Task *task = mInjector.front();
+      mInjector.pop_front();
+      mInjectorSize.fetch_sub(1);
+      return task;
+    }
+  }
+
+  const size_t count = mWorkers.size();
+  const size_t first_victim = count > 0 ? random() % count : 0;
+
+  for (size_t i = 0; i < count; i++) {
+    const size_t victim = (first_victim + i) % count;
+    if (victim == index) {
+      continue;
+    }
+    if (Task *task = mWorkers[victim]->deque.steal()) {
+      return task;
+    }
+  }
+
+  return nullptr;
+}
+
+bool Threadpool::try_run_task() {
+  thread_local std::minstd_rand random(std::random_device{}());
+
+  const size_t index = current_pool == this ? current_worker : NOT_A_WORKER;
+
+  if (Task *task = find_task(index, random)) {
+    run_task(task, index);
+    return true;
   }
+  return false;
+}
+
+void Threadpool::run_task(Task *task, const size_t index) {
+  if (TaskObserver *observer = mObserver.load(std::memory_order_acquire)) {
+    const auto begin = TaskObserver::Clock::now();
+    (*task)();
+    observer->task_finished(index == NOT_A_WORKER ? size() : index, begin,
+                            TaskObserver::Clock::now());
+  } else {
+    (*task)();
+  }
+  task->~Task();
+  TaskCache::deallocate(task);
+
+  // wakes the workers waiting for the last task to exit
+  if (mPending.fetch_sub(1) == 1 && !mRunning.load()) {
+    mEpoch.fetch_add(1);
+    mEpoch.notify_all();
+  }
+}
+
+void Threadpool::notify() {
+  mEpoch.fetch_add(1);
+  if (mSleeping.load() > 0) {
+    mEpoch.notify_one();
+  }
+}
+
+void Threadpool::spawn(Task &&task) {
+  auto *item = new (TaskCache::allocate()) Task(std::move(task));
+  mPending.fetch_add(1);
+
+  if (current_pool == this) {
+    mWorkers[current_worker]->deque.push(item);
+  } else {
+    std::unique_lock<std::mutex> lock(mInjectorMutex);
+    mInjector.push_back(item);
+    mInjectorSize.fetch_add(1);
+  }
+
+  notify();
 }
 
 void Threadpool::join() {
-  {
-    std::unique_lock<std::mutex> lock(mMutex);
-    mRunning = false;
+  mRunning.store(false);
+  mEpoch.fetch_add(1);
+  mEpoch.notify_all();
+
+  // joins the threads, the deques are destroyed only after all of them exit
+  for (auto &worker : mWorkers) {
+    worker->thread.join();
+  }
+  mWorkers.clear();
+}
+
+void Threadpool::resize(const size_t thread_count) {
+  join();
+
+  mRunning.store(true);
+  start(thread_count);
+
+  if (mAffinity != topology::AffinityPolicy::None) {
+    pin(mAffinity);
+  }
+}
+
+bool Threadpool::is_worker() const { return current_pool == this; }
+
+size_t Threadpool::worker_index() const { return current_worker; }
+
+Partitioning Threadpool::affine_partitioning(const size_t count,
+                                             const size_t max_threads) const {
+  // A few chunks per participant, so the others can take over the chunks of
+  // a worker that is late. Independent of `max_threads`, so the chunks stay
+  // the same across loops with different limits.
+  const size_t participants = size() + 1;
+  return {Schedule::Static, std::max(count / (4 * participants), 1uz),
+          max_threads};
+}
+
+void Threadpool::pin(const topology::AffinityPolicy policy) {
+  const auto sets = topology::placement(policy, size(), topology::read_cpus());
+
+  for (size_t i = 0; i < size(); i++) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    if (sets.empty()) {
+      // unpin, i.e. allow all the CPUs of the process
+      sched_getaffinity(0, sizeof(cpus), &cpus);
+    } else {
+      for (const unsigned cpu : sets[i]) {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+
+    if (pthread_setaffinity_np(mWorkers[i]->thread.native_handle(),
+                               sizeof(cpus), &cpus) != 0) {
+      throw std::runtime_error("Failed to set the affinity of a worker.");
+    }
+  }
+
+  mAffinity = policy;
+}
+
+namespace detail {
+
+LoopState::LoopState(const size_t count, const Partitioning partitioning,
+                     const size_t participants)
+    : mCount(count), mSchedule(partitioning.schedule),
+      mGrain(partitioning.grain), mParticipants(std::max(participants, 1uz)) {
+  if (mGrain == 0) {
+    switch (mSchedule) {
+    case Schedule::Static:
+      mGrain = (mCount + mParticipants - 1) / mParticipants;
+      break;
+    case Schedule::Dynamic:
+      // a few chunks per thread to balance uneven iterations
+      mGrain = std::max(mCount / (8 * mParticipants), 1uz);
+      break;
+    case Schedule::Guided:
+      mGrain = 1;
+      break;
+    }
+  }
+
+  if (mSchedule == Schedule::Static) {
+    mClaimed = std::make_unique<std::atomic<bool>[]>(max_chunks());
+    mSlotNext = std::make_unique<std::atomic<size_t>[]>(mParticipants);
+    for (size_t slot = 0; slot < mParticipants; slot++) {
+      mSlotNext[slot].store(slot);
+    }
+  }
+}
+
+bool LoopState::claim(const size_t slot, size_t &begin, size_t &end) {
+  if (mSchedule == Schedule::Static) {
+    const size_t chunks = max_chunks();
+
+    const auto try_claim = [&](const size_t chunk) {
+      if (mClaimed[chunk].load(std::memory_order_relaxed) ||
+          mClaimed[chunk].exchange(true)) {
+        return false;
+      }
+      begin = chunk * mGrain;
+      end = std::min(begin + mGrain, mCount);
+      return true;
+    };
+
+    // own chunks first, then whatever the others didn't get to yet
+    auto &own = mSlotNext[slot % mParticipants];
+    for (size_t chunk = own.load(std::memory_order_relaxed); chunk < chunks;
+         chunk = own.load(std::memory_order_relaxed)) {
+      own.store(chunk + mParticipants, std::memory_order_relaxed);
+      if (try_claim(chunk)) {
+        return true;
+      }
+    }
+    for (size_t chunk = mNext.load(); chunk < chunks; chunk++) {
+      if (try_claim(chunk)) {
+        return true;
+      }
+      // all chunks before this one are claimed, skip them next time
+      mNext.store(chunk + 1, std::memory_order_relaxed);
+    }
+    return false;
+  }
+
+  if (mSchedule == Schedule::Dynamic) {
+    begin = mNext.fetch_add(mGrain);
+    if (begin >= mCount) {
+      return false;
+    }
+    end = std::min(begin + mGrain, mCount);
+    return true;
+  }
+
+  begin = mNext.load();
+  while (begin < mCount) {
+    const size_t chunk = std::max((mCount - begin) / mParticipants, mGrain);
+    end = std::min(begin + chunk, mCount);
+    // on failure, somebody else claimed a chunk and `begin` is reloaded
+    if (mNext.compare_exchange_weak(begin, end)) {
+      return true;
+    }
   }
-  mCondition.notify_all();
-  mWorkers.clear(); // joins the threads
+  return false;
 }
 
+void LoopState::complete(const size_t iterations) {
+  if (mDone.fetch_add(iterations) + iterations == mCount) {
+    mDone.notify_all();
+  }
+}
+
+bool LoopState::done() const { return mDone.load() == mCount; }
+
+void LoopState::wait() const {
+  size_t done;
+  while ((done = mDone.load()) < mCount) {
+    mDone.wait(done);
+  }
+}
+
+size_t LoopState::max_chunks() const {
+  return (mCount + mGrain - 1) / mGrain;
+}
+
+} // namespace detail
+
 Threadpool pool{};
 
 } // namespace threadpool
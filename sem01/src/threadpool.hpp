@@ -1,23 +1,233 @@
 #pragma once
 
+#include "task.hpp"
+#include "topology.hpp"
+#include "work_stealing_deque.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <deque>
+#include <exception>
 #include <functional>
-#include <future>
-#include <queue>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <ranges>
 #include <thread>
 #include <utility>
+#include <variant>
 #include <vector>
 
 namespace threadpool {
 
+template <typename R> class future;
+
+/**
+ * @brief How a parallel loop splits its iteration range into chunks, similar
+ * to the OpenMP `schedule` clause.
+ */
+enum class Schedule {
+  /// One equally sized chunk per participating thread, or chunks of `grain`
+  /// iterations when it is given. Best for uniform iterations. Chunk `k` goes
+  /// to the `k % participants`-th thread, unless it is still unclaimed after
+  /// that thread finished its own chunks.
+  Static,
+  /// Chunks of `grain` iterations handed out on demand. Best for iterations
+  /// of very different cost.
+  Dynamic,
+  /// Chunks proportional to the remaining work, shrinking down to `grain`.
+  /// Starts with few large chunks and balances the end with small ones.
+  Guided,
+};
+
+/**
+ * @brief Chunking parameters of a parallel loop.
+ */
+struct Partitioning {
+  Schedule schedule = Schedule::Guided;
+  /// Size of the (smallest) chunk, 0 picks it from the iteration count.
+  size_t grain = 0;
+  /// Maximum number of threads working on the loop, including the caller,
+  /// 0 for no limit.
+  size_t max_threads = 0;
+};
+
 namespace detail {
 
-bool try_run_task(std::unique_lock<std::mutex> &&lock,
-                  std::queue<std::function<void()>> &tasks);
+/**
+ * @class LoopState
+ * @brief Shared state of a single parallel loop.
+ *
+ * Hands out chunks of `[0, count)` to the participating threads through an
+ * atomic cursor and counts the finished iterations, so the caller can wait
+ * for the whole loop. The chunk boundaries depend only on the count and the
+ * partitioning, never on the timing.
+ *
+ * Each participant has a slot: workers use their index, an outside caller
+ * the slot after the last worker. With the static schedule, participants
+ * first take the chunks of their own slot.
+ */
+class LoopState {
+public:
+  LoopState(size_t count, Partitioning partitioning, size_t participants);
+
+  /**
+   * @brief Claim the next chunk `[begin, end)` for the participant in the
+   * given slot.
+   * @return Whether there was a chunk left.
+   */
+  bool claim(size_t slot, size_t &begin, size_t &end);
+
+  /**
+   * @brief Mark a number of claimed iterations as finished.
+   */
+  void complete(size_t iterations);
+
+  /**
+   * @brief Whether all iterations are finished.
+   */
+  bool done() const;
+
+  /**
+   * @brief Block until all iterations are finished.
+   */
+  void wait() const;
+
+  /**
+   * @brief Upper bound on the number of chunks the loop is split into.
+   */
+  size_t max_chunks() const;
+
+private:
+  size_t mCount;
+  Schedule mSchedule;
+  size_t mGrain;
+  size_t mParticipants;
+
+  // static schedule only, whether each chunk was already claimed and the
+  // next own chunk of each slot
+  std::unique_ptr<std::atomic<bool>[]> mClaimed;
+  std::unique_ptr<std::atomic<size_t>[]> mSlotNext;
+
+  alignas(64) std::atomic<size_t> mNext{0};
+  alignas(64) std::atomic<size_t> mDone{0};
+};
+
+/**
+ * @class FutureState
+ * @brief Shared state of a `future` and the task computing its value.
+ *
+ * Reference counted by hand, the task and the future hold one reference
+ * each, and allocated from a `BlockCache`, so creating a future doesn't
+ * allocate in the steady state.
+ */
+template <typename R> class FutureState {
+public:
+  /**
+   * @brief Create a new state with two references.
+   */
+  static FutureState *create() { return new (Cache::allocate()) FutureState; }
+
+  /**
+   * @brief Call `f` and store its result or exception, then wake up the
+   * waiting thread.
+   */
+  template <typename F> void run(F &f) noexcept {
+    try {
+      if constexpr (std::is_void_v<R>) {
+        f();
+        mValue.emplace();
+      } else {
+        mValue.emplace(f());
+      }
+    } catch (...) {
+      mException = std::current_exception();
+    }
+
+    mReady.store(true, std::memory_order_release);
+    mReady.notify_all();
+  }
+
+  bool ready() const { return mReady.load(std::memory_order_acquire); }
+
+  /**
+   * @brief Block until the value is stored.
+   */
+  void wait() const { mReady.wait(false, std::memory_order_acquire); }
+
+  /**
+   * @brief Move the stored value out, or rethrow the stored exception. The
+   * value has to be ready.
+   */
+  R take() {
+    if (mException) {
+      std::rethrow_exception(mException);
+    }
+    if constexpr (!std::is_void_v<R>) {
+      return std::move(*mValue);
+    }
+  }
+
+  /**
+   * @brief Drop one reference, destroying the state after the last one.
+   */
+  void release() {
+    if (mReferences.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->~FutureState();
+      Cache::deallocate(this);
+    }
+  }
+
+  /**
+   * @brief Deleter releasing the reference held by a `std::unique_ptr`.
+   */
+  struct Release {
+    void operator()(FutureState *state) const { state->release(); }
+  };
+
+private:
+  FutureState() = default;
+
+  using Value = std::conditional_t<std::is_void_v<R>, std::monostate, R>;
+
+  std::atomic<bool> mReady{false};
+  std::atomic<uint32_t> mReferences{2};
+  std::optional<Value> mValue;
+  std::exception_ptr mException;
+
+  struct Cache;
+};
+
+template <typename R>
+struct FutureState<R>::Cache
+    : BlockCache<sizeof(FutureState<R>), alignof(FutureState<R>)> {};
 
 } // namespace detail
 
-template <typename R> class future;
+/**
+ * @class TaskObserver
+ * @brief Gets notified about every task run by a pool, see
+ * `Threadpool::observe`.
+ */
+class TaskObserver {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  virtual ~TaskObserver() = default;
+
+  /**
+   * @brief Called on the thread that ran the task, right after it finished.
+   *
+   * @param slot Index of the worker that ran the task, or the size of the pool
+   * for a thread from outside of it.
+   * @param begin When the task started.
+   * @param end When the task finished.
+   */
+  virtual void task_finished(size_t slot, Clock::time_point begin,
+                             Clock::time_point end) = 0;
+};
 
 /**
  * @class Threadpool
@@ -27,6 +237,13 @@ template <typename R> class future;
  * values (futures) and supports parallel processing of ranges. It simplifies
  * concurrent task execution by managing a pool of worker threads.
  *
+ * Each worker has its own work-stealing deque. Tasks spawned from inside the
+ * pool go to the deque of the spawning worker, tasks spawned from other
+ * threads to a shared injection queue. Idle workers first look into their own
+ * deque, then into the injection queue, and finally try to steal from the
+ * other workers, starting at a random one. When there is nothing to do, they
+ * park until new work is spawned.
+ *
  * @note By default, the thread pool size is determined by the number of
  * hardware threads available on the system.
  */
@@ -55,30 +272,14 @@ public:
   Threadpool &operator=(const Threadpool &) = delete;
 
   /**
-   * @brief Move construct a new Threadpool object.
-   * @param other The other Threadpool to move from.
+   * @brief Delete move constructor, the workers hold a pointer to the pool.
    */
-  Threadpool(Threadpool &&other) {
-    mWorkers = std::move(other.mWorkers);
-    mTasks = std::move(other.mTasks);
-    mRunning = std::move(other.mRunning);
-  }
+  Threadpool(Threadpool &&) = delete;
 
   /**
-   * @brief Move assign a Threadpool object.
-   *
-   * @param other The other Threadpool to move from.
-   *
-   * @return Threadpool& Reference to this Threadpool.
+   * @brief Delete move assignment operator.
    */
-  Threadpool &operator=(Threadpool &&other) {
-    mWorkers = std::move(other.mWorkers);
-    mTasks = std::move(other.mTasks);
-    mRunning = std::move(other.mRunning);
-    return *this;
-  }
-
-  using Task = std::function<void()>;
+  Threadpool &operator=(Threadpool &&) = delete;
 
   /**
    * @brief Spawn a task and returns a future to retrieve its result.
@@ -90,39 +291,38 @@ public:
    * @param f The callable object to execute.
    * @param args The arguments to pass to the callable object.
    *
-   * @return std::future<Result> A future that can be used to retrieve the
-   * result of the task once it completes.
+   * @return future<Result> A future that can be used to retrieve the result
+   * of the task once it completes.
    */
   template <typename Functor, typename... Args,
             typename Result = std::invoke_result_t<Functor, Args...>>
-  inline std::future<Result> spawn_with_future(Functor &&f, Args &&...args) {
-    auto task = std::make_shared<std::packaged_task<Result()>>(
-        [f = std::forward<Functor>(f), &args...] {
-          return f(std::forward<Args>(args)...);
-        });
-    spawn([task]() { (*task)(); });
-    return future(task->get_future(), *this);
+  inline future<Result> spawn_with_future(Functor &&f, Args &&...args) {
+    auto *state = detail::FutureState<Result>::create();
+    spawn(Task([state, f = std::forward<Functor>(f), &args...]() mutable {
+      auto call = [&] { return f(std::forward<Args>(args)...); };
+      state->run(call);
+      state->release();
+    }));
+    return future<Result>(state, *this);
   }
 
   /**
    * @brief Spawn a task to be executed by the thread pool.
    *
+   * When called from one of the workers, the task is pushed to its local
+   * deque, otherwise to the shared injection queue.
+   *
    * @param task A callable object representing the task to execute.
    */
-  inline void spawn(Task &&task) {
-    {
-      std::unique_lock<std::mutex> lock(mMutex);
-      mTasks.emplace(std::move(task));
-    }
-    mCondition.notify_one();
-  }
+  void spawn(Task &&task);
 
   /**
    * @brief Spawn a background task inside the thread pool.
    *
+   * The arguments are copied (or moved) into the task, like with `std::bind`.
+   *
    * @tparam F The type of the function to execute.
    * @tparam Args The types of the arguments to pass to the function.
-   * @tparam U The return type of the function.
    *
    * @param f The function to execute.
    * @param args The arguments to pass to the function.
@@ -131,12 +331,14 @@ public:
   inline void spawn(F &&f, Args &&...args) {
     static_assert(std::is_same_v<std::invoke_result_t<F, Args...>, void>,
                   "The function must not return any value.");
-    // This may be better handled by a lambda-capture, to prevent unneccessary
-    // binder objects, but I can't get it to work with the forwarding. It has to
-    // be able to pass args both as references and as values, but I only managed
-    // to get it to work as values.
-    spawn(static_cast<Task>(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+    if constexpr (sizeof...(Args) == 0) {
+      spawn(Task(std::forward<F>(f)));
+    } else {
+      spawn(Task([f = std::forward<F>(f),
+                  ... args = std::forward<Args>(args)]() mutable {
+        std::invoke(f, args...);
+      }));
+    }
   }
 
   /**
@@ -147,6 +349,16 @@ public:
    */
   void join();
 
+  /**
+   * @brief Restart the pool with a different number of workers.
+   *
+   * Waits for all pending tasks first, like `join`. The workers are pinned by
+   * the same policy as before.
+   *
+   * @param thread_count The new number of worker threads.
+   */
+  void resize(size_t thread_count);
+
   /**
    * @brief Transform a range into a vector of futures by applying a functor
    * to each element in parallel.
@@ -159,14 +371,14 @@ public:
    * @param range The range of elements to transform.
    * @param functor The callable object to apply to each element of the range.
    *
-   * @return std::vector<std::future<Result>> A vector of futures representing
-   * the results of the transformations.
+   * @return std::vector<future<Result>> A vector of futures representing the
+   * results of the transformations.
    */
   template <std::ranges::input_range Range,
             typename Item = std::ranges::range_value_t<Range>, typename Functor,
             typename Result = std::invoke_result_t<Functor, Item &>>
-  inline std::vector<std::future<Result>> transform(Range &range,
-                                                    Functor &&functor) {
+  inline std::vector<future<Result>> transform(Range &range,
+                                               Functor &&functor) {
     auto f = [this, &functor](auto &item) {
       return spawn_with_future(std::forward<Functor>(functor), item);
     };
@@ -185,14 +397,14 @@ public:
    * @param range The range of elements to transform.
    * @param functor The callable object to apply to each element of the range.
    *
-   * @return std::vector<std::future<Result>> A vector of futures representing
-   * the results of the transformations.
+   * @return std::vector<future<Result>> A vector of futures representing the
+   * results of the transformations.
    */
   template <std::ranges::input_range Range,
             typename Item = std::ranges::range_value_t<Range>, typename Functor,
             typename Result = std::invoke_result_t<Functor, Item>>
-  inline std::vector<std::future<Result>> transform(Range &&range,
-                                                    Functor &&functor) {
+  inline std::vector<future<Result>> transform(Range &&range,
+                                               Functor &&functor) {
     auto f = [this, &functor](auto &&item) {
       return spawn_with_future(std::bind(std::forward<Functor>(functor), item));
     };
@@ -223,45 +435,437 @@ public:
     }
   }
 
+  /**
+   * @brief Run a body over chunks of the index range `[0, count)` in
+   * parallel.
+   *
+   * Unlike `for_each`, which spawns a task per element, this spawns at most
+   * one helper task per worker. The helpers and the calling thread then claim
+   * chunks of the range until there are none left. Returns once all chunks
+   * are finished.
+   *
+   * @param count Number of iterations.
+   * @param body Callable receiving the bounds `(begin, end)` of a chunk.
+   * @param partitioning How the range is split into chunks.
+   */
+  template <typename Body>
+  inline void parallel_for_chunks(const size_t count, Body &&body,
+                                  const Partitioning partitioning = {}) {
+    if (count == 0) {
+      return;
+    }
+
+    // the caller takes part too, unless it is one of the workers already
+    size_t participants = size() + !is_worker();
+    if (partitioning.max_threads != 0) {
+      participants = std::min(participants, partitioning.max_threads);
+    }
+    auto state =
+        std::make_shared<detail::LoopState>(count, partitioning, participants);
+
+    const auto work = [this](detail::LoopState &state, auto &body) {
+      const size_t slot = is_worker() ? worker_index() : size();
+      size_t begin, end;
+      while (state.claim(slot, begin, end)) {
+        body(begin, end);
+        state.complete(end - begin);
+      }
+    };
+
+    // The body is only touched after a successful claim, which can't happen
+    // after the loop finished, so the helpers can hold it by reference.
+    const size_t helpers =
+        std::min(participants - 1, state->max_chunks() - 1);
+    for (size_t i = 0; i < helpers; i++) {
+      spawn([state, &body, work] { work(*state, body); });
+    }
+
+    work(*state, body);
+
+    // help with other tasks while the last chunks finish
+    while (!state->done()) {
+      if (!try_run_task()) {
+        state->wait();
+        break;
+      }
+    }
+  }
+
+  /**
+   * @brief Call `body(i)` for each index in `[0, count)` in parallel.
+   *
+   * @param count Number of iterations.
+   * @param body Callable receiving the index.
+   * @param partitioning How the range is split into chunks.
+   */
+  template <typename Body>
+  inline void parallel_for(const size_t count, Body &&body,
+                           const Partitioning partitioning = {}) {
+    parallel_for_chunks(
+        count,
+        [&body](const size_t begin, const size_t end) {
+          for (size_t i = begin; i < end; i++) {
+            body(i);
+          }
+        },
+        partitioning);
+  }
+
+  /**
+   * @brief Apply a functor to each element of a range in parallel and store
+   * the results into a pre-sized output range.
+   *
+   * @param input The elements to transform.
+   * @param output Receives the result for `input[i]` at `output[i]`, has to be
+   * at least as long as `input`. Must allow concurrent writes to different
+   * elements (so not `std::vector<bool>`).
+   * @param functor The callable object to apply.
+   * @param partitioning How the range is split into chunks.
+   */
+  template <std::ranges::random_access_range Input,
+            std::ranges::random_access_range Output, typename Functor>
+    requires std::ranges::sized_range<Input> &&
+             std::invocable<Functor &, std::ranges::range_reference_t<Input>>
+  inline void parallel_transform(Input &&input, Output &&output,
+                                 Functor &&functor,
+                                 const Partitioning partitioning = {}) {
+    const auto in = std::ranges::begin(input);
+    const auto out = std::ranges::begin(output);
+
+    parallel_for(
+        std::ranges::size(input),
+        [&functor, &in, &out](const size_t i) { out[i] = functor(in[i]); },
+        partitioning);
+  }
+
+  /**
+   * @brief Apply a functor to each element of a range in parallel.
+   *
+   * @param input The elements to transform.
+   * @param functor The callable object to apply.
+   * @param partitioning How the range is split into chunks.
+   *
+   * @return The results, in the order of the input.
+   */
+  template <std::ranges::random_access_range Input, typename Functor,
+            typename Result = std::invoke_result_t<
+                Functor &, std::ranges::range_reference_t<Input>>>
+    requires std::ranges::sized_range<Input>
+  inline std::vector<Result>
+  parallel_transform(Input &&input, Functor &&functor,
+                     const Partitioning partitioning = {}) {
+    static_assert(!std::is_same_v<Result, bool>,
+                  "std::vector<bool> can't be written concurrently, use the "
+                  "overload with an output range");
+
+    std::vector<Result> output(std::ranges::size(input));
+    parallel_transform(input, output, functor, partitioning);
+    return output;
+  }
+
+  /**
+   * @brief Transform each element of a range and combine the results in
+   * parallel, like `std::transform_reduce`.
+   *
+   * Each chunk is reduced on its own, then the partial results are combined
+   * in the order of the chunks, so the result is deterministic even for
+   * non-associative operations such as floating point addition.
+   *
+   * @param input The elements to reduce.
+   * @param identity The initial value of every partial result.
+   * @param reduce Combines two results.
+   * @param transform Maps an element to a result.
+   * @param partitioning How the range is split into chunks.
+   */
+  template <std::ranges::random_access_range Input, typename T,
+            typename Reduce, typename Transform>
+    requires std::ranges::sized_range<Input>
+  inline T parallel_reduce(Input &&input, T identity, Reduce &&reduce,
+                           Transform &&transform,
+                           const Partitioning partitioning = {}) {
+    const auto in = std::ranges::begin(input);
+
+    std::mutex mutex;
+    std::vector<std::pair<size_t, T>> partials;
+
+    parallel_for_chunks(
+        std::ranges::size(input),
+        [&](const size_t begin, const size_t end) {
+          T partial = identity;
+          for (size_t i = begin; i < end; i++) {
+            partial = reduce(std::move(partial), transform(in[i]));
+          }
+
+          std::unique_lock<std::mutex> lock(mutex);
+          partials.emplace_back(begin, std::move(partial));
+        },
+        partitioning);
+
+    std::ranges::sort(partials, {}, &std::pair<size_t, T>::first);
+
+    T result = std::move(identity);
+    for (auto &[_, partial] : partials) {
+      result = reduce(std::move(result), std::move(partial));
+    }
+    return result;
+  }
+
+  /**
+   * @brief Remove the elements whose flag is not set, keeping the order of
+   * the rest (a stable stream compaction).
+   *
+   * The flags are split into fixed chunks. The kept elements of each chunk
+   * are counted in parallel, a prefix sum over the counts gives the position
+   * each chunk starts at in the result, and the chunks then move their kept
+   * elements there in parallel. Only the elements themselves are moved, into
+   * a new buffer that replaces the old one.
+   *
+   * @param items The elements to filter.
+   * @param keep Whether to keep each element, at least as long as `items`.
+   * @param partitioning How the elements are split into chunks. The grain is
+   * the size of the chunks, a few per thread by default.
+   *
+   * @return The number of kept elements.
+   */
+  template <typename T, std::ranges::random_access_range Flags>
+    requires std::default_initializable<T> && std::movable<T>
+  inline size_t parallel_compact(std::vector<T> &items, const Flags &keep,
+                                 const Partitioning partitioning = {}) {
+    const size_t count = items.size();
+    const auto flags = std::ranges::begin(keep);
+
+    // the counting and the scattering have to agree on the chunks
+    const size_t grain = partitioning.grain != 0
+                             ? partitioning.grain
+                             : std::max(count / (4 * (size() + 1)), 1uz);
+    const size_t chunks = (count + grain - 1) / grain;
+    const Partitioning per_chunk{partitioning.schedule, 1,
+                                 partitioning.max_threads};
+
+    // offsets[c] is where the kept elements of chunk c go
+    std::vector<size_t> offsets(chunks + 1);
+    parallel_for(
+        chunks,
+        [&](const size_t chunk) {
+          const size_t begin = chunk * grain;
+          const size_t end = std::min(begin + grain, count);
+          offsets[chunk + 1] = std::count_if(
+              flags + begin, flags + end, [](const auto &flag) {
+                return static_cast<bool>(flag);
+              });
+        },
+        per_chunk);
+
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+      offsets[chunk + 1] += offsets[chunk];
+    }
+
+    std::vector<T> kept(offsets.back());
+    parallel_for(
+        chunks,
+        [&](const size_t chunk) {
+          const size_t begin = chunk * grain;
+          const size_t end = std::min(begin + grain, count);
+          size_t out = offsets[chunk];
+          for (size_t i = begin; i < end; i++) {
+            if (flags[i]) {
+              kept[out++] = std::move(items[i]);
+            }
+          }
+        },
+        per_chunk);
+
+    items = std::move(kept);
+    return items.size();
+  }
+
+  /**
+   * @brief Static partitioning of `count` elements into a few chunks per
+   * participant of a loop started from outside of the pool.
+   *
+   * Loops over the same number of elements with this partitioning process
+   * each chunk on the same worker (as long as it isn't busy elsewhere), so
+   * memory first touched by a worker in one loop is still in its cache and
+   * NUMA node in the next one.
+   */
+  Partitioning affine_partitioning(size_t count, size_t max_threads = 0) const;
+
+  /**
+   * @brief Pin the workers to CPUs according to the given policy.
+   *
+   * @throws std::runtime_error if the affinity can't be set.
+   */
+  void pin(topology::AffinityPolicy policy);
+
+  /**
+   * @brief The policy the workers are currently pinned by.
+   */
+  topology::AffinityPolicy affinity() const { return mAffinity; }
+
+  /**
+   * @brief Report every task run from now on to the given observer, or stop
+   * reporting with `nullptr`.
+   *
+   * @note The observer has to stay alive until it is replaced and the tasks
+   * running at that moment finish, e.g. until the next `join()`.
+   */
+  void observe(TaskObserver *observer) { mObserver.store(observer); }
+
   size_t size() const { return mWorkers.size(); }
 
 private:
-  std::vector<std::jthread> mWorkers;
-  std::queue<Task> mTasks;
-  std::mutex mMutex;
-  std::condition_variable mCondition;
-  bool mRunning = true;
+  struct Worker {
+    detail::WorkStealingDeque<Task *> deque;
+    std::jthread thread;
+  };
+
+  /**
+   * @brief Main loop of the worker with the given index.
+   */
+  void run_worker(size_t index);
+
+  /**
+   * @brief Create and start the given number of workers.
+   */
+  void start(size_t thread_count);
+
+  /**
+   * @brief Find a task to run: from the local deque of the worker (if any),
+   * the injection queue, or by stealing from the other workers.
+   *
+   * @param index Index of the calling worker, or `NOT_A_WORKER`.
+   * @param random Random generator used to pick the first victim.
+   *
+   * @return The task, or `nullptr` if there is none.
+   */
+  Task *find_task(size_t index, std::minstd_rand &random);
+
+  /**
+   * @brief Run a pending task on the calling thread, if there is any.
+   *
+   * @return Whether a task was run.
+   */
+  bool try_run_task();
+
+  /**
+   * @brief Whether the calling thread is one of the workers of this pool.
+   */
+  bool is_worker() const;
+
+  /**
+   * @brief Index of the calling worker, only valid if `is_worker()`.
+   */
+  size_t worker_index() const;
+
+  /**
+   * @brief Run and destroy a task taken from the pool.
+   *
+   * @param index Index of the calling worker, or `NOT_A_WORKER`.
+   */
+  void run_task(Task *task, size_t index);
+
+  /**
+   * @brief Wake up a parked worker, if there is one.
+   */
+  void notify();
+
+  static constexpr size_t NOT_A_WORKER = static_cast<size_t>(-1);
+
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+
+  std::mutex mInjectorMutex;
+  std::deque<Task *> mInjector;
+  std::atomic<size_t> mInjectorSize{0};
+
+  // number of spawned tasks that haven't finished yet
+  std::atomic<size_t> mPending{0};
+
+  // bumped on every spawn, parked workers wait for it to change
+  std::atomic<uint32_t> mEpoch{0};
+  std::atomic<size_t> mSleeping{0};
+
+  std::atomic<bool> mRunning{true};
+
+  topology::AffinityPolicy mAffinity = topology::AffinityPolicy::None;
+
+  std::atomic<TaskObserver *> mObserver{nullptr};
 
   template <typename R> friend class future;
-  friend bool detail::try_run_task(std::unique_lock<std::mutex> &&lock,
-                                   std::queue<Task> &tasks);
 };
 
-template <typename R> class future : public std::future<R> {
+/**
+ * @class future
+ * @brief Handle to the result of a task spawned with `spawn_with_future`.
+ *
+ * Dropping the future without waiting is fine, the task still runs to
+ * completion.
+ */
+template <typename R> class future {
 public:
-  future(std::future<R> &&future, Threadpool &pool)
-      : std::future<R>(std::move(future)), mPool(pool) {}
+  future(detail::FutureState<R> *state, Threadpool &pool)
+      : mState(state), mPool(&pool) {}
 
-  R get() {
-    Threadpool::Task task;
-    while (!this->valid()) {
-      std::unique_lock<std::mutex> lock(mPool.mMutex);
-      if (mPool.mTasks.empty()) {
-        lock.unlock();
-        std::this_thread::yield();
-        return this->get();
-      }
+  future(future &&other) noexcept
+      : mState(std::exchange(other.mState, nullptr)), mPool(other.mPool) {}
 
-      task = std::move(mPool.mTasks.front());
-      mPool.mTasks.pop();
+  future &operator=(future &&other) noexcept {
+    if (this != &other) {
+      reset();
+      mState = std::exchange(other.mState, nullptr);
+      mPool = other.mPool;
+    }
+    return *this;
+  }
 
-      lock.unlock();
-      task();
+  future(const future &) = delete;
+  future &operator=(const future &) = delete;
+
+  ~future() { reset(); }
+
+  /**
+   * @brief Whether the future still refers to a result, i.e. `get` wasn't
+   * called yet.
+   */
+  bool valid() const { return mState != nullptr; }
+
+  /**
+   * @brief Wait until the result is ready, running other tasks of the pool
+   * in the meantime.
+   *
+   * This way a worker waiting for a nested task never blocks the task it's
+   * waiting for, even if it sits in its own deque.
+   */
+  void wait() const {
+    while (!mState->ready()) {
+      if (!mPool->try_run_task()) {
+        // no task is queued anywhere, so ours is already running elsewhere
+        mState->wait();
+        return;
+      }
     }
   }
 
+  /**
+   * @brief Wait for the result and return it, or rethrow the exception thrown
+   * by the task. Invalidates the future.
+   */
+  R get() {
+    wait();
+    const std::unique_ptr<detail::FutureState<R>,
+                          typename detail::FutureState<R>::Release>
+        state(std::exchange(mState, nullptr));
+    return state->take();
+  }
+
 private:
-  Threadpool &mPool;
+  void reset() {
+    if (mState) {
+      std::exchange(mState, nullptr)->release();
+    }
+  }
+
+  detail::FutureState<R> *mState;
+  Threadpool *mPool;
 };
 
 /**
@@ -0,0 +1,255 @@
+#include "topology.hpp"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+namespace topology {
+
+constexpr std::string_view CPU_DIRECTORY = "/sys/devices/system/cpu";
+
+/**
+ * @brief Reads a single number from a sysfs file.
+ */
+std::optional<unsigned> read_number(const std::filesystem::path &file) {
+  std::ifstream stream(file);
+  unsigned value;
+  if (!(stream >> value)) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+/**
+ * @brief Lowest CPU of a sysfs CPU list such as `0-3,8-11`.
+ */
+std::optional<unsigned> first_in_list(const std::filesystem::path &file) {
+  std::ifstream stream(file);
+  std::string list;
+  if (!std::getline(stream, list)) {
+    return std::nullopt;
+  }
+
+  unsigned value;
+  const auto [_, error] =
+      std::from_chars(list.data(), list.data() + list.size(), value);
+  if (error != std::errc{}) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+/**
+ * @brief Lowest CPU sharing the highest cache level with the given CPU.
+ */
+std::optional<unsigned> cache_group(const std::filesystem::path &cpu) {
+  std::optional<unsigned> group;
+  unsigned highest_level = 0;
+
+  std::error_code error;
+  for (const auto &index :
+       std::filesystem::directory_iterator(cpu / "cache", error)) {
+    if (!index.path().filename().string().starts_with("index")) {
+      continue;
+    }
+    const auto level = read_number(index.path() / "level");
+    if (level && *level > highest_level) {
+      highest_level = *level;
+      group = first_in_list(index.path() / "shared_cpu_list");
+    }
+  }
+
+  return group;
+}
+
+/**
+ * @brief NUMA node of a CPU, from its `nodeN` link.
+ */
+unsigned numa_node(const std::filesystem::path &cpu) {
+  std::error_code error;
+  for (const auto &entry : std::filesystem::directory_iterator(cpu, error)) {
+    const auto name = entry.path().filename().string();
+    unsigned node;
+    if (name.starts_with("node") &&
+        std::from_chars(name.data() + 4, name.data() + name.size(), node).ec ==
+            std::errc{}) {
+      return node;
+    }
+  }
+  return 0;
+}
+
+std::vector<Cpu> read_cpus() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    throw std::runtime_error("Failed to get the CPU affinity.");
+  }
+
+  std::vector<Cpu> cpus;
+
+  for (unsigned id = 0; id < CPU_SETSIZE; id++) {
+    if (!CPU_ISSET(id, &allowed)) {
+      continue;
+    }
+
+    const auto directory =
+        std::filesystem::path(CPU_DIRECTORY) / ("cpu" + std::to_string(id));
+
+    cpus.push_back({
+        .id = id,
+        .package =
+            read_number(directory / "topology/physical_package_id").value_or(0),
+        .core = read_number(directory / "topology/core_id").value_or(id),
+        .cache_group = cache_group(directory).value_or(0),
+        .node = numa_node(directory),
+    });
+  }
+
+  return cpus;
+}
+
+AffinityPolicy parse_policy(const std::string_view name) {
+  if (name == "none") {
+    return AffinityPolicy::None;
+  } else if (name == "compact") {
+    return AffinityPolicy::Compact;
+  } else if (name == "scatter") {
+    return AffinityPolicy::Scatter;
+  } else if (name == "cores") {
+    return AffinityPolicy::PhysicalCores;
+  } else if (name == "ccx") {
+    return AffinityPolicy::Ccx;
+  }
+  throw std::invalid_argument(
+      std::format("Unknown affinity policy '{}', expected one of none, "
+                  "compact, scatter, cores, ccx.",
+                  name));
+}
+
+std::string_view policy_name(const AffinityPolicy policy) {
+  switch (policy) {
+  case AffinityPolicy::None:
+    return "none";
+  case AffinityPolicy::Compact:
+    return "compact";
+  case AffinityPolicy::Scatter:
+    return "scatter";
+  case AffinityPolicy::PhysicalCores:
+    return "cores";
+  case AffinityPolicy::Ccx:
+    return "ccx";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief The CPUs ordered by locality: NUMA node, package, cache group, core
+ * and then the SMT siblings.
+ */
+std::vector<Cpu> compact_order(std::vector<Cpu> cpus) {
+  std::ranges::sort(cpus, {}, [](const Cpu &cpu) {
+    return std::tuple(cpu.node, cpu.package, cpu.cache_group, cpu.core,
+                      cpu.id);
+  });
+  return cpus;
+}
+
+/**
+ * @brief Index of each CPU among the SMT siblings of its core, 0 for the
+ * first one.
+ */
+std::vector<unsigned> sibling_ranks(const std::vector<Cpu> &cpus) {
+  std::map<std::pair<unsigned, unsigned>, unsigned> seen;
+  std::vector<unsigned> ranks;
+  ranks.reserve(cpus.size());
+
+  for (const auto &cpu : cpus) {
+    ranks.push_back(seen[{cpu.package, cpu.core}]++);
+  }
+  return ranks;
+}
+
+std::vector<CpuSet> placement(const AffinityPolicy policy, const size_t count,
+                              const std::vector<Cpu> &cpus) {
+  if (policy == AffinityPolicy::None || cpus.empty()) {
+    return {};
+  }
+
+  const auto ordered = compact_order(cpus);
+  const auto ranks = sibling_ranks(ordered);
+
+  // the order in which the workers take the CPUs
+  std::vector<Cpu> sequence;
+
+  switch (policy) {
+  case AffinityPolicy::None:
+  case AffinityPolicy::Compact:
+  case AffinityPolicy::Ccx:
+    sequence = ordered;
+    break;
+
+  case AffinityPolicy::PhysicalCores:
+    for (size_t i = 0; i < ordered.size(); i++) {
+      if (ranks[i] == 0) {
+        sequence.push_back(ordered[i]);
+      }
+    }
+    break;
+
+  case AffinityPolicy::Scatter: {
+    // round-robin over the cache groups, first siblings of all cores first
+    std::map<std::tuple<unsigned, unsigned, unsigned>, std::vector<Cpu>>
+        groups;
+    for (size_t rank = 0; sequence.size() < ordered.size(); rank++) {
+      groups.clear();
+      for (size_t i = 0; i < ordered.size(); i++) {
+        if (ranks[i] == rank) {
+          const auto &cpu = ordered[i];
+          groups[{cpu.node, cpu.package, cpu.cache_group}].push_back(cpu);
+        }
+      }
+
+      for (size_t i = 0;; i++) {
+        bool any = false;
+        for (const auto &[_, group] : groups) {
+          if (i < group.size()) {
+            sequence.push_back(group[i]);
+            any = true;
+          }
+        }
+        if (!any) {
+          break;
+        }
+      }
+    }
+    break;
+  }
+  }
+
+  std::vector<CpuSet> sets(count);
+  for (size_t worker = 0; worker < count; worker++) {
+    const auto &cpu = sequence[worker % sequence.size()];
+
+    if (policy == AffinityPolicy::Ccx) {
+      for (const auto &other : ordered) {
+        if (other.package == cpu.package &&
+            other.cache_group == cpu.cache_group) {
+          sets[worker].push_back(other.id);
+        }
+      }
+    } else {
+      sets[worker].push_back(cpu.id);
+    }
+  }
+
+  return sets;
+}
+
+} // namespace topology
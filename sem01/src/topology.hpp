@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <format>
+#include <string_view>
+#include <vector>
+
+/**
+ * CPU topology of the machine, as described by `/sys/devices/system/cpu`, and
+ * the policies for placing the worker threads onto it.
+ */
+namespace topology {
+
+struct Cpu {
+  unsigned id;
+  unsigned package;
+  // physical core, shared by the SMT siblings
+  unsigned core;
+  // lowest id of the CPUs sharing the last level cache (a CCX on Zen)
+  unsigned cache_group;
+  unsigned node;
+};
+
+/**
+ * @brief Reads the topology of the CPUs the process is allowed to run on.
+ *
+ * Missing information (e.g. no sysfs in a container) falls back to treating
+ * each CPU as its own core in a single cache group and NUMA node.
+ */
+std::vector<Cpu> read_cpus();
+
+/**
+ * @brief How the worker threads are pinned to the CPUs.
+ */
+enum class AffinityPolicy {
+  /// No pinning, leave it to the scheduler.
+  None,
+  /// Fill the CPUs in order, SMT siblings next to each other, so the workers
+  /// share as much cache as possible.
+  Compact,
+  /// Spread the workers over the last level caches first, then over the
+  /// cores, and only then over the SMT siblings.
+  Scatter,
+  /// One worker per physical core, SMT siblings stay unused.
+  PhysicalCores,
+  /// Fill one last level cache group (CCX) after another, letting each
+  /// worker float between the CPUs of its group.
+  Ccx,
+};
+
+/**
+ * @brief Parses a policy name: `none`, `compact`, `scatter`, `cores` or
+ * `ccx`.
+ *
+ * @throws std::invalid_argument if the name is unknown.
+ */
+AffinityPolicy parse_policy(std::string_view name);
+
+std::string_view policy_name(AffinityPolicy policy);
+
+using CpuSet = std::vector<unsigned>;
+
+/**
+ * @brief Computes the CPUs each worker may run on under the given policy.
+ *
+ * @param policy The placement policy.
+ * @param count Number of workers.
+ * @param cpus The available CPUs, see `read_cpus`.
+ *
+ * @return The CPU set of each worker, or an empty vector for
+ * `AffinityPolicy::None`. With more workers than CPUs, the assignment wraps
+ * around.
+ */
+std::vector<CpuSet> placement(AffinityPolicy policy, size_t count,
+                              const std::vector<Cpu> &cpus);
+
+} // namespace topology
+
+template <> struct std::formatter<topology::AffinityPolicy> {
+  constexpr auto parse(std::format_parse_context const &ctx) const {
+    return ctx.begin();
+  }
+  template <typename FormatContext>
+  auto format(const topology::AffinityPolicy &policy,
+              FormatContext &ctx) const {
+    return std::format_to(ctx.out(), "{}", topology::policy_name(policy));
+  }
+};
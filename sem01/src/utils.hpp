@@ -9,11 +9,16 @@ inline float map_range(const float in_min, const float in_max,
          out_min;
 }
 
-template <typename T, typename Serial, typename Parallel>
-constexpr inline std::unique_ptr<T> choose_by_mode(ProcessingMode mode) {
+/**
+ * @brief Creates the serial or the parallel implementation of `T`, passing
+ * the arguments to the constructor of the parallel one.
+ */
+template <typename T, typename Serial, typename Parallel, typename... Args>
+constexpr inline std::unique_ptr<T> choose_by_mode(ProcessingMode mode,
+                                                   Args &&...parallel_args) {
   if (mode == ProcessingMode::Serial) {
     return std::make_unique<Serial>();
   } else {
-    return std::make_unique<Parallel>();
+    return std::make_unique<Parallel>(std::forward<Args>(parallel_args)...);
   }
 }
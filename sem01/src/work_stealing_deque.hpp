@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace threadpool::detail {
+
+/**
+ * @class WorkStealingDeque
+ * @brief A Chase-Lev work-stealing deque.
+ *
+ * The owning worker pushes and pops items at the bottom (LIFO, so the most
+ * recently spawned and thus cache-hot task runs first), while the other
+ * workers steal from the top (FIFO, taking the oldest and usually the largest
+ * tasks). Only the owner may call `push` and `pop`, `steal` is safe to call
+ * from any thread.
+ *
+ * Follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Lê et al., 2013). The buffer grows when full; the old buffers are kept
+ * until the deque is destroyed, since a thief may still be reading from them.
+ *
+ * @tparam T Pointer type of the items, `nullptr` is reserved for "empty".
+ */
+template <typename T> class WorkStealingDeque {
+public:
+  /**
+   * @brief Construct an empty deque.
+   * @param capacity Initial capacity, has to be a power of two.
+   */
+  explicit WorkStealingDeque(size_t capacity = 256)
+      : mBuffer(new Buffer(capacity)) {}
+
+  ~WorkStealingDeque() { delete mBuffer.load(std::memory_order_relaxed); }
+
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  /**
+   * @brief Push an item to the bottom. Owner only.
+   */
+  void push(T item) {
+    const int64_t bottom = mBottom.load(std::memory_order_relaxed);
+    const int64_t top = mTop.load(std::memory_order_acquire);
+    Buffer *buffer = mBuffer.load(std::memory_order_relaxed);
+
+    if (bottom - top > static_cast<int64_t>(buffer->capacity) - 1) {
+      buffer = grow(buffer, top, bottom);
+    }
+
+    buffer->store(bottom, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    mBottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Pop an item from the bottom. Owner only.
+   * @return The item, or `nullptr` if the deque is empty.
+   */
+  T pop() {
+    const int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+    Buffer *buffer = mBuffer.load(std::memory_order_relaxed);
+    mBottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = mTop.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+      mBottom.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    T item = buffer->load(bottom);
+
+    if (top == bottom) {
+      // the last item, race against the thieves for it
+      if (!mTop.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      mBottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    return item;
+  }
+
+  /**
+   * @brief Steal an item from the top. Safe from any thread.
+   * @return The item, or `nullptr` if the deque is empty.
+   */
+  T steal() {
+    int64_t top = mTop.load(std::memory_order_acquire);
+
+    while (true) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const int64_t bottom = mBottom.load(std::memory_order_acquire);
+
+      if (top >= bottom) {
+        return nullptr;
+      }
+
+      T item = mBuffer.load(std::memory_order_acquire)->load(top);
+
+      // on failure, somebody else took the item and `top` is reloaded
+      if (mTop.compare_exchange_weak(top, top + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+        return item;
+      }
+    }
+  }
+
+  /**
+   * @brief Whether the deque looks empty. Only a snapshot, may be outdated by
+   * the time it returns.
+   */
+  bool empty() const {
+    return mTop.load(std::memory_order_relaxed) >=
+           mBottom.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Buffer {
+    explicit Buffer(const size_t capacity)
+        : capacity(capacity), mask(capacity - 1),
+          items(std::make_unique<std::atomic<T>[]>(capacity)) {}
+
+    T load(const int64_t index) const {
+      return items[index & mask].load(std::memory_order_relaxed);
+    }
+
+    void store(const int64_t index, T item) {
+      items[index & mask].store(item, std::memory_order_relaxed);
+    }
+
+    size_t capacity;
+    size_t mask;
+    std::unique_ptr<std::atomic<T>[]> items;
+  };
+
+  Buffer *grow(Buffer *old, const int64_t top, const int64_t bottom) {
+    auto *buffer = new Buffer(old->capacity * 2);
+    for (int64_t i = top; i < bottom; i++) {
+      buffer->store(i, old->load(i));
+    }
+
+    mRetired.emplace_back(old);
+    mBuffer.store(buffer, std::memory_order_release);
+    return buffer;
+  }
+
+  // on separate cache lines, since the owner and the thieves write them
+  alignas(64) std::atomic<int64_t> mTop{0};
+  alignas(64) std::atomic<int64_t> mBottom{0};
+  alignas(64) std::atomic<Buffer *> mBuffer;
+  std::vector<std::unique_ptr<Buffer>> mRetired;
+};
+
+} // namespace threadpool::detail